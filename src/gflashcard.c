@@ -9,42 +9,583 @@
  * <http://www.gnu.org/licenses/>。
  * ************************************************************************/
 
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE // pwritev和syscall不在XSI中
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
 #include <string.h>
+#include <math.h>
 #include <ctype.h>
 #include <signal.h>
 #include <time.h>
-#include <locale.h>
-#include <libintl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if HAVE_TIMERFD
+#include <poll.h>
+#include <sys/timerfd.h>
+#endif
+#if HAVE_INOTIFY
+#include <sys/inotify.h>
+#endif
+#if HAVE_SIGNALFD
+#include <sys/signalfd.h>
+#endif
+#if HAVE_PIDFD
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#endif
+#if HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
 
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
+#if HAVE_MMAP || HAVE_IO_URING
+#include <sys/mman.h>
+#endif
+#if HAVE_IO_URING
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+/* 能否在運行時選用SSE4.2的crc32指令 */
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HAVE_SSE42_CRC32 1
+#include <nmmintrin.h>
+#endif
+
+#undef LINE_MAX // limits.h中也有定義
 #define LINE_MAX 1024
 
 /* 能形成長時記憶的最少連續答對次數。這個因人、問題復雜性而異 */
 #define N_LONG_TERM_MEMORY 10
 
-#define _(s) gettext(s)
+/* 限時復習時，沒有答題用時記錄的抽認卡的預計答題用時（單位：秒） */
+#define DEFAULT_LATENCY 30
+
+/* 限時復習的最長時限（單位：分鐘） */
+#define MAX_MINUTES (7*24*60)
+
+/* 從未答對過的抽認卡的記憶穩定期（單位：秒），每連續答對一次加倍 */
+#define BASE_STABILITY 86400.0
+
+/* 內存中一輪排序的抽認卡數上限。抽認卡更多時把排好序的各輪排序鍵寫入臨時
+ * 文件，再多路歸併，使排序鍵所佔的內存不隨抽認卡數增長 */
+#define SORT_RUN 262144
+
+/* 多路歸併時每一輪的讀緩衝所容納的排序鍵數 */
+#define SORT_BUFFER 256
+
+/* 分卷時的最多卷數 */
+#define MAX_VOLUME 1024
+
+/* 保存數據文件時每個分片的抽認卡數，以及每次pwritev最多寫入的分片數 */
+#define SAVE_SHARD 4096
+#define SAVE_IOV 64
+
+/* 壓縮抽認卡文字所用的預設字典的最大長度。字典越長壓縮率越高，但每壓縮
+ * 一個記錄都要重新載入一次字典，讀入數據文件就越慢 */
+#define DICT_SIZE 8192
+
+/* 訓練預設字典時最多統計的行數 */
+#define DICT_SAMPLE 1048576
+
+/* 讀寫數據文件時每個請求的字節數和同時在途的請求數 */
+#define AIO_BLOCK 262144
+#define AIO_DEPTH 4
+
+/* 相鄰記錄的文字湊夠這麼多字節就一起壓縮成一塊，以分攤每次載入字典的開銷 */
+#define PACK_BLOCK 4096
+
+/* 只壓縮文字而未指定--cache-size時，解壓出的文字的緩存上限（單位：字節） */
+#define PACKED_CACHE_SIZE 65536
+
+/* FNV-1a散列的初值 */
+#define HASH_BASIS 14695981039346656037ULL
+
+/* 每次復習都把復習日志寫入文件，以防進程被殺死；但每記錄這麼多次復習才同步
+ * 到磁盤一次，以防系統崩潰 */
+#define JOURNAL_BATCH 8
+
+/* 交互復習時等待輸入期間每隔這麼多秒把復習日志同步到磁盤一次（單位：秒），
+ * 不必等到湊滿JOURNAL_BATCH次復習 */
+#define AUTOSAVE_INTERVAL 30
+
+/* 等待輸入時最多同時追蹤這麼多個由命令行啓動的子進程 */
+#define SESSION_CHILDREN 16
+
+/* 漸進載入時解析線程每解析出這麼多個記錄就交給前台一次 */
+#define LOAD_BATCH 256
+
+/* bench子命令每種排序重復的次數，取其中最快的一次 */
+#define BENCH_ROUNDS 5
+
+/* 保存時記下下次啓動後最先復習的這麼多個抽認卡，下次啓動時不必排序即可
+ * 開始復習。復習隊列文件的開頭標記 */
+#define QUEUE_SIZE 1024
+#define QUEUE_MAGIC "GFQ1"
+
+/* 歸檔段的文件名後綴，已形成長時記憶的抽認卡保存時移入其中 */
+#define ARCHIVE_SUFFIX ".archive"
+
+#define _(s) translate(s)
 #define die(...) do{fprintf(stderr, __VA_ARGS__); exit(EXIT_FAILURE);}while(0)
 #define Free(p) (free(p), (p)=NULL)
 
+typedef struct deck_tag // 卡組，可嵌套
+{
+    char *name; // 卡組名，根卡組爲空串
+    int ndue; // 待復習的抽認卡數，含子卡組，下同
+    int nlearned; // 已形成長時記憶的抽認卡數
+    int nquiz; // 復習總次數
+    double nright; // 答對總次數
+    struct deck_tag *parent; // 父卡組
+    struct deck_tag *child; // 第一個子卡組
+    struct deck_tag *sibling; // 下一個兄弟卡組
+} Deck;
+
+typedef struct arena_block_tag // 暫存區內存塊
+{
+    struct arena_block_tag *prev; // 上一個內存塊
+    size_t size; // 可用字節數
+    size_t used; // 已用字節數
+    char data[]; // 內存塊內容
+} Arena_block;
+
+typedef struct // 暫存區，存放出題時臨時生成的文字，每出一題即清空一次
+{
+    Arena_block *block; // 當前內存塊
+} Arena;
+
+typedef struct // 填空標記：{{c序號::文字}}或{{c序號::文字::提示}}
+{
+    int no; // 填空序號
+    const char *text; // 被遮蔽的文字
+    int len; // 被遮蔽的文字的長度
+    const char *hint; // 提示，可以爲NULL
+    int hint_len; // 提示的長度
+    const char *end; // 填空標記之後的位置
+} Cloze;
+
+typedef struct // 限時復習的候選抽認卡
+{
+    struct flashcard_tag *fc; // 抽認卡
+    double value; // 單位時間的預期記憶收益
+} Candidate;
+
+typedef struct // 監視模式下的數據文件
+{
+    const char *filename; // 文件名
+    int wd; // inotify監視描述符
+    time_t mtime; // 最後修改時間
+    time_t due_time; // 晚於上次提醒時間的最早的下次復習時間，0表示沒有
+} Watch;
+
+#if HAVE_TIMERFD
+typedef struct // 交互復習的事件循環，等待輸入時一併處理信號、定時器、子進程和文件改動
+{
+    char buf[LINE_MAX]; // 已從標準輸入讀入而未取走的內容
+    size_t len; // buf中內容的長度
+    bool eof; // 標準輸入是否已讀完
+    int tfd; // 定時同步復習日志的timerfd，-1表示未打開
+    int sfd; // 接收SIGINT和SIGTERM的signalfd，-1表示未打開
+    int nchild; // 追蹤中的子進程個數
+    pid_t pids[SESSION_CHILDREN]; // 子進程號
+    int pidfds[SESSION_CHILDREN]; // 子進程的pidfd，可讀時表示子進程已退出
+} Session;
+#endif
+
+typedef struct // 以64位散列值爲鍵的散列表的表項
+{
+    uint64_t key; // 鍵
+    struct flashcard_tag *fc; // 值，爲NULL時表示空表項
+    bool taken; // 是否已被take_index取走
+} Index_entry;
+
+typedef struct // 以開放定址法解決衝突的散列表，允許鍵重複
+{
+    Index_entry *entries; // 表項
+    size_t size; // 表項數，爲2的冪
+    size_t count; // 已插入的表項數
+} Index;
+
+typedef struct // 檢查數據文件的結果
+{
+    const char *filename; // 文件名
+    char *report; // 檢查報告
+    size_t size; // 檢查報告的長度
+    int nerror; // 錯誤數
+    bool done; // 是否已檢查完畢
+} Check;
+
+typedef struct // 並行檢查數據文件的線程所共享的任務表
+{
+    Check *checks; // 各文件的檢查結果
+    void (*check)(const char *filename, const char *data, size_t len,
+        FILE *out, int *nerror); // 檢查函數
+    int n; // 文件數
+    int next; // 下一個待檢查文件的序號
+#if HAVE_PTHREAD
+    pthread_mutex_t mutex; // 保護next和各文件的done
+    pthread_cond_t cond; // 有文件檢查完畢
+#endif
+} Check_pool;
+
+typedef struct cache_entry_tag // 正文緩存中的一個記錄的文字
+{
+    struct flashcard_tag *owner; // 擁有文字的抽認卡
+    size_t size; // 佔用的字節數
+    struct cache_entry_tag *prev; // 較近使用的記錄
+    struct cache_entry_tag *next; // 較早使用的記錄
+} Cache_entry;
+
+typedef struct // 低內存模式下按需從數據文件讀入抽認卡文字的LRU緩存
+{
+    FILE *fp; // 數據文件
+    size_t capacity; // 字節數上限，0表示不啓用低內存模式，文字常駐內存
+    size_t size; // 已用字節數
+    size_t peak; // 已用字節數的峰值
+    Cache_entry *head; // 最近使用的記錄
+    Cache_entry *tail; // 最早使用的記錄，最先被淘汰
+    unsigned long hits; // 命中次數
+    unsigned long misses; // 未命中次數
+    unsigned long evictions; // 淘汰次數
+} Text_cache;
+
+typedef struct // 抽認卡的排序鍵，按各字段依次比較，小者在前
+{
+    struct flashcard_tag *fc; // 抽認卡
+    int rank; // 0表示已到復習時間，1表示未到，2表示已形成長時記憶
+    time_t next_time; // 已到復習時間時爲下次復習時間，否則爲0
+    int n_contin_right; // 連續答對次數
+    double right_rate; // 答題正確率
+    size_t seq; // 在原鏈表中的位置，使排序保持穩定
+} Sort_key;
+
+typedef struct // 基數排序的元素：壓成無符號整數的排序鍵及其在排序鍵數組中的下標
+{
+    uint64_t key; // 壓縮後的排序鍵
+    size_t index; // 下標
+} Radix_pair;
+
+typedef struct // 多路歸併時臨時文件中的一輪排序鍵
+{
+    Sort_key buf[SORT_BUFFER]; // 讀緩衝
+    off_t offset; // 下一批排序鍵在臨時文件中的位置
+    size_t remain; // 尚未讀入緩衝的排序鍵數
+    size_t n; // 緩衝中的排序鍵數
+    size_t pos; // 緩衝中下一個排序鍵的位置
+} Sort_run;
+
+typedef struct // 訓練預設字典時統計的行
+{
+    const char *s; // 行的內容，含換行符
+    size_t len; // 行的長度
+    size_t count; // 出現次數
+} Dict_line;
+
+typedef struct text_block_tag // 一起壓縮的若干個相鄰記錄的文字
+{
+    unsigned char *data; // 壓縮後的文字
+    size_t len; // 壓縮後的長度
+    size_t raw_len; // 壓縮前的長度
+    int nref; // 文字在此塊中的記錄數
+} Text_block;
+
+#if HAVE_ZLIB
+typedef struct // 以預設字典壓縮抽認卡文字的壓縮器和解壓器
+{
+    unsigned char dict[DICT_SIZE]; // 由數據文件中反復出現的行構成的預設字典
+    size_t dict_len; // 預設字典的長度
+    z_stream deflater; // 壓縮流，各記錄共用
+    z_stream inflater; // 解壓流，各記錄共用
+    char *buf; // 拼接或解壓文字的緩衝，各塊共用
+    size_t buf_size; // 緩衝的字節數
+    const Text_block *unpacked; // 緩衝中是哪一塊解壓後的文字，NULL表示沒有
+    size_t raw_total; // 各塊壓縮前的總長度
+    size_t packed_total; // 各塊壓縮後的總長度
+    bool ready; // 字典已生成，壓縮流和解壓流已初始化
+} Packer;
+#endif
+
+#if HAVE_IO_URING
+typedef struct // 直接以系統調用操作的io_uring實例
+{
+    int fd; // io_uring的文件描述符
+    void *sq_ring; // 提交隊列的映射
+    size_t sq_ring_size; // 提交隊列的映射的長度
+    void *cq_ring; // 完成隊列的映射，內核支持單次映射時與sq_ring相同
+    size_t cq_ring_size; // 完成隊列的映射的長度
+    struct io_uring_sqe *sqes; // 提交隊列項
+    size_t sqes_size; // 提交隊列項的總長度
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array; // 提交隊列的頭、尾、掩碼和索引
+    unsigned *cq_head, *cq_tail, *cq_mask; // 完成隊列的頭、尾和掩碼
+    struct io_uring_cqe *cqes; // 完成隊列項
+} Uring;
+#endif
+
+typedef struct // 一個讀請求
+{
+    char *buf; // 緩衝，AIO_BLOCK字節
+    size_t len; // 請求讀取的字節數，完成後爲實際讀取的字節數
+    off_t offset; // 文件位置
+    bool busy; // 已提交而尚未完成
+} Aio_slot;
+
+typedef struct // 讓多個讀請求同時在途的文件讀取，不支持io_uring時退回到同步讀取
+{
+    int fd; // 所讀取的文件
+    bool failed; // 是否有請求出錯
+#if HAVE_IO_URING
+    Uring ring; // io_uring實例
+    bool use_ring; // io_uring是否可用
+#endif
+    Aio_slot slots[AIO_DEPTH]; // 各請求
+} Aio;
+
+typedef struct // 預讀數據文件的按行讀取器，用法與fgets相同
+{
+    Aio aio; // 各預讀請求依次讀取相鄰的塊
+    int cur; // 正在從中讀取的請求
+    size_t pos; // 在當前請求的緩衝中的位置
+    off_t next; // 下一個預讀請求的文件位置
+    off_t offset; // 已讀出的內容在文件中的位置，相當於ftello
+    bool eof; // 是否已讀到文件末尾
+} Reader;
+
+typedef struct // 保存數據文件時一個分片的序列化結果
+{
+    struct flashcard_tag *first; // 分片的第一個抽認卡
+    int n; // 分片中的抽認卡數，不含派生抽認卡
+    char *buf; // 序列化的內容
+    size_t size; // 內容的長度
+    bool ok; // 是否序列化成功
+    bool done; // 是否已序列化完畢
+} Save_shard;
+
+typedef struct // 並行序列化各分片的線程所共享的任務表
+{
+    Save_shard *shards; // 各分片
+    const Deck *root; // 牌組樹的根
+    int volume; // 只寫入這一卷的抽認卡，爲負時寫入全部抽認卡
+    int n; // 分片數
+    int next; // 下一個待序列化的分片的序號
+#if HAVE_PTHREAD
+    pthread_mutex_t mutex; // 保護next和各分片的done
+    pthread_cond_t cond; // 有分片序列化完畢
+#endif
+} Save_pool;
+
+typedef struct // 按次序寫入各分片的寫入器，用io_uring時寫入與序列化後面的分片重疊
+{
+    int fd; // 所寫入的臨時文件
+    off_t offset; // 下一批內容的文件位置
+    struct iovec iov[SAVE_IOV]; // 待寫入或在途的一批內容
+    int n; // 在途的寫請求中的段數，0表示沒有在途的寫請求
+    bool ok; // 是否都寫入成功
+#if HAVE_IO_URING
+    Uring ring; // io_uring實例
+    bool use_ring; // io_uring是否可用
+#endif
+} Shard_writer;
+
+typedef struct // 分卷數據文件中的一卷，由清單文件列出
+{
+    char *filename; // 卷文件名，相對路徑已換成相對於清單文件所在目錄的路徑
+    char *comment; // 卷的頭部注釋
+    char *trailer; // 卷的最後一個記錄之後的注釋
+    struct stat st; // 卷文件在載入或保存時的狀態
+    struct flashcard_tag *parsed; // 並行載入時該卷的鏈表頭，有自己的卡組樹
+    bool changed; // 保存時是否需要重寫
+    bool uring; // 讀取時是否用了io_uring
+} Volume;
+
+typedef struct // 並行解析各卷的線程所共享的任務表
+{
+    int next; // 下一個待解析的卷的序號
+#if HAVE_PTHREAD
+    pthread_mutex_t mutex; // 保護next
+#endif
+} Volume_pool;
+
+typedef struct // --profile選項輸出的運行統計
+{
+    double load_time; // 載入數據文件的用時（單位：秒）
+    double save_time; // 保存數據文件的用時（單位：秒）
+    bool uring; // 讀取數據文件時是否用了io_uring
+    bool save_uring; // 保存數據文件時是否用了io_uring
+    double first_time; // 漸進載入時等到第一批抽認卡的用時（單位：秒）
+    bool queued; // 載入時是否沿用了上次保存的復習隊列
+} Profile;
+
+typedef struct // 分段檢查UTF-8文字時，跨段的字符的解碼狀態
+{
+    int need; // 當前字符還缺的後續字節數，0表示已在字符邊界上
+    unsigned char lo, hi; // 下一個後續字節的取值範圍
+} Utf8_state;
+
+typedef struct // 一條譯文
+{
+    const char *msgid; // 原文
+    const char *msgstr; // 譯文
+} Message;
+
+typedef struct // 一種語言的譯文表，由po2c.awk從.po文件生成
+{
+    const char *lang; // 語言名，形如zh_CN
+    Message *messages; // 各條譯文，選定後按原文排序
+    size_t n; // 譯文條數
+} Catalog;
+
+#include "messages.h"
+
+#if HAVE_PTHREAD
+typedef struct // 漸進載入時在後台解析數據文件的線程與前台共享的狀態
+{
+    pthread_t thread; // 解析線程
+    pthread_mutex_t mutex; // 保護staged和done
+    pthread_cond_t cond; // 有新的抽認卡交出或已全部解析完畢
+    bool running; // 是否正在漸進載入
+    bool done; // 解析線程是否已讀完數據文件
+    double start; // 開始載入的時間
+    const char *filename; // 數據文件
+    struct flashcard_tag *parsed; // 解析線程的鏈表頭，有自己的卡組樹，不與前台共用
+    struct flashcard_tag *pending, *pending_tail; // 解析線程攢着尚未交出的抽認卡
+    int npending; // pending中的抽認卡數
+    struct flashcard_tag *staged, *staged_tail; // 已交給前台而尚未並入的抽認卡
+    uint64_t *seed; // 復習隊列中各抽認卡的標識，已排序，只由前台使用
+    size_t nseed, missing; // seed中的標識數、尚未並入的個數
+    Index ids; // 已並入的抽認卡的標識，用于使新抽認卡的標識不與之重複
+} Loader;
+#endif
+
 typedef struct flashcard_tag // 抽認卡記錄
 {
     char *comment; // 注釋內容
     char *question; // 問題
-    char *answer; // 標準答案
+    char *answer; // 標準答案，當爲表頭時則爲最後一個記錄之後的注釋
     int nquiz; // 復習次數，當爲表頭時則爲復習題數
     int n_contin_right; // 連續答對次數
     double right_rate; // 答題正確率（單位：%）
+    double latency; // 平均答題用時（單位：秒），0表示未知
     time_t prev_time; // 上一次復習時間
     time_t next_time; // 下一次復習時間
+    Deck *deck; // 所屬卡組，當爲表頭時則爲根卡組
+    uint64_t id; // 穩定標識，由問題和答案的內容決定
+    struct flashcard_tag *owner; // 與之共用文字的原抽認卡，爲NULL時表示自身擁有文字
+    struct flashcard_tag *variant; // 與之共用文字的下一個派生抽認卡
+    int cloze; // 填空序號，0表示非填空抽認卡
+    bool reverse; // 是否爲反向抽認卡
+    bool dirty; // 統計信息在本次運行中是否有改動
+    bool checksum; // 保存時是否爲記錄加上校驗和
+    bool archived; // 是否已移入歸檔段，僅對擁有文字的抽認卡有效，保存時不再寫入數據文件
+    int volume; // 所在的卷，僅對擁有文字的抽認卡有效，數據文件未分卷時爲0
+    uint64_t rec_hash; // 記錄原文的散列值，僅對擁有文字的抽認卡有效
+    off_t offset; // 記錄原文在數據文件中的位置，僅對擁有文字的抽認卡有效，下同
+    size_t length; // 記錄原文的長度
+    Cache_entry *cached; // 低內存模式下文字在正文緩存中的表項，NULL表示未讀入
+    Text_block *block; // 壓縮後的文字所在的塊，NULL表示未壓縮
+    size_t block_pos; // 文字在塊解壓後的位置，注釋、問題和答案依次各以'\0'結束
     struct flashcard_tag *next; // 下一個抽認卡記錄
 } Flashcard;
 
-void set_locale(const char *program);
+void select_catalog(void);
+Catalog *find_catalog(const char *name, size_t len);
+const char *translate(const char *msgid);
+int cmp_message(const void *p1, const void *p2);
 void usage(const char *program);
+bool is_subcommand(const char *arg);
 void set_signal(void);
+void on_signal(int sig);
+void check_quit(void);
 Flashcard *load_flashcard(const char *filename);
+void read_data_file(Flashcard *list, const char *filename, int volume, Index *known,
+    Flashcard *target);
+bool read_manifest(const char *filename);
+char **expand_manifests(int *n, char **filenames);
+void load_volumes(Flashcard *list);
+void *volume_worker(void *arg);
+Flashcard *adopt_flashcards(Flashcard *fc, const Flashcard *list, Flashcard *tail);
+int split_data_file(const char *filename, const char *count);
+void free_volumes(void);
+#if HAVE_ZLIB
+void archive_flashcards(Flashcard *list);
+bool read_archive(Flashcard *list, const char *filename);
+uint64_t hash_record(Flashcard *fc, const Deck *root);
+int export_data_file(const char *filename, bool restore);
+#endif
+#if HAVE_PTHREAD
+Flashcard *start_loading(const char *filename);
+void *load_worker(void *arg);
+void stage_flashcard(Flashcard *fc);
+void publish_loaded(bool done);
+bool merge_loaded(Flashcard *list, bool wait);
+void finish_loading(Flashcard *list);
+void end_loading(Flashcard *list);
+int cmp_id(const void *p1, const void *p2);
+#endif
+void merge_sorted(Flashcard *list, Flashcard *src);
+uint64_t *read_queue(size_t *k, uint64_t *total);
+bool load_queue(Flashcard *list);
+void merge_unsorted(Flashcard *list, bool sort);
+void save_queue(const Flashcard *list);
+void sift_queue(Sort_key *heap, size_t n, size_t i);
+unsigned char *put_varint(unsigned char *p, uint64_t n);
+bool get_varint(const unsigned char **p, const unsigned char *end, uint64_t *n);
+long long epoch_day(time_t t);
+Flashcard *parse_record(Flashcard *list, const char *record);
+bool load_text(Flashcard *fc);
+bool read_text(Flashcard *owner);
+void parse_text(Flashcard *owner, const char *record);
+void release_text(Flashcard *owner);
+void uncache_text(Flashcard *owner);
+void unlink_cache_entry(Cache_entry *e);
+void link_text(Flashcard *owner);
+size_t parse_size(const char *s);
+double get_seconds(void);
+void show_profile(void);
+void store_text(Flashcard *owner);
+#if HAVE_ZLIB
+void pack_flashcards(Flashcard *list);
+void train_dictionary(const Flashcard *list);
+int cmp_dict_text(const void *p1, const void *p2);
+int cmp_dict_value(const void *p1, const void *p2);
+void pack_texts(Flashcard **owners, size_t n);
+void unpack_text(Flashcard *owner);
+void release_block(Text_block *block);
+char *get_packer_buf(size_t size);
+void free_packer(void);
+#endif
+bool reload_if_changed(Flashcard *list);
+void reload_flashcard(Flashcard *list, const char *filename);
+void remove_records(Flashcard *list, Index *records);
+void watch_data_file(void);
+int replay_journal(Flashcard *list, const char *filename);
+void open_journal(void);
+void append_journal(const Flashcard *fc);
+void sync_journal(void);
+void commit_journal(void);
+bool is_data_file_changed(void);
+bool is_file_changed(const char *filename, const struct stat *old);
+bool sync_parent_dir(const char *filename);
+void init_index(Index *index, size_t n);
+void reserve_index(Index *index, size_t n);
+void free_index(Index *index);
+void insert_index(Index *index, uint64_t key, Flashcard *fc);
+Index_entry *find_index(Index *index, uint64_t key, const Flashcard *fc);
+Flashcard *take_index(Index *index, uint64_t key);
+Flashcard *search_index(const Index *index, uint64_t key);
+uint64_t hash_string(uint64_t h, const char *s);
 FILE *Fopen(const char *filename, const char *mode);
 Flashcard *create_flashcard(void);
 void free_flashcards(Flashcard *list);
@@ -52,15 +593,66 @@ void free_flashcard(Flashcard *node);
 void add_flashcard(Flashcard *node, Flashcard *list, time_t cur_time);
 void del_flashcard(Flashcard *node, Flashcard *list);
 void sort_flashcard(Flashcard *list);
+void make_sort_key(Sort_key *key, Flashcard *fc, size_t seq, time_t cur_time);
+int cmp_sort_key(const void *p1, const void *p2);
+bool radix_sort_keys(Sort_key *keys, size_t n);
+uint64_t pack_rate(const Sort_key *key);
+Radix_pair *radix_sort(Radix_pair *a, Radix_pair *b, size_t n);
+int bit_width(uint64_t n);
+int bench_sort(int n, char **filenames);
+Flashcard *merge_runs(Flashcard *a, Flashcard *b, time_t cur_time);
+bool spill_sort(Flashcard *list, Sort_key *keys, size_t total, time_t cur_time);
+void merge_spilled_runs(Flashcard *list, FILE *fp, size_t nrun, size_t total);
+bool fill_run(Sort_run *run, int fd);
+void sift_runs(const Sort_run *runs, size_t *heap, size_t n, size_t i);
 bool has_flashcard(const Flashcard *list);
 bool is_front_flashcard(const Flashcard *fc1, const Flashcard *fc2, bool cmp_time);
 bool is_long_term_memory(const Flashcard *fc);
 char *cat_string(char *dst, const char *src);
 void load_info(Flashcard *fc, const char *input);
+void load_deck(Flashcard *fc, Deck *root, const char *input);
 void fix_flashcard(Flashcard *fc);
+void fix_text(Flashcard *fc);
+Flashcard *install_flashcard(Flashcard *fc, const Flashcard *list, Flashcard *tail);
+Flashcard *create_reverse_flashcard(Flashcard *owner);
+Flashcard *get_cloze_flashcard(Flashcard *owner, int n);
+void append_variant(Flashcard *owner, Flashcard *fc);
+void fix_cloze_flashcards(Flashcard *owner);
+Flashcard *take_cloze(Flashcard **held, int no);
+void copy_info(Flashcard *dst, const Flashcard *src);
+const char *find_cloze(const char *s, Cloze *cloze);
+int next_cloze_no(const char *question, int no);
+char *mask_cloze(const char *question, int no, bool reveal);
+const char *get_question(Flashcard *fc);
+const char *get_answer(Flashcard *fc);
+uint64_t hash_flashcard(const Flashcard *fc);
+void unique_ids(Flashcard *fc, Index *ids);
+char *alloc_arena(Arena *arena, size_t size);
+void reset_arena(Arena *arena);
+void free_arena(Arena *arena);
+bool is_blank(const char *s);
+Deck *create_deck(const char *name, Deck *parent);
+void free_decks(Deck *deck);
+Deck *get_deck(Deck *root, const char *path);
+void count_flashcard(const Flashcard *fc, int sign);
+char *format_deck_path(char *buf, const Deck *deck);
+void show_decks(const Deck *deck, int depth);
 void quiz(Flashcard *list);
+void quiz_in_time(Flashcard *list, int minutes);
+Candidate *collect_candidates(const Flashcard *list, int *n);
+int cmp_candidate(const void *p1, const void *p2);
+double forgetting_risk(const Flashcard *fc, time_t now);
+double quiz_flashcard(Flashcard *list, Flashcard *fc);
 void show_question(const char *question);
 void input_question(void);
+char *read_stdin(char *line, int size);
+char *read_input(char *line, int size);
+#if HAVE_TIMERFD
+void open_session(void);
+void close_session(void);
+void handle_events(const struct pollfd *fds, int n);
+#endif
+void track_child(pid_t pid);
 void show_answer(const char *answer);
 bool judge_answer(void);
 void eval_answer(Flashcard *fc, bool right);
@@ -71,462 +663,4382 @@ int exec_sys_cmd(const char *cmd);
 char *get_sys_cmd(const char *s);
 void exec_cmd(char *cmd);
 char *trim_cmd(char *cmd);
+size_t space_len(const char *s, const char *end);
+size_t fold_fullwidth(char *s);
+bool is_ascii(const char *s, size_t n);
+size_t strip_cr(char *line);
+void append_chunk(char **dest, const char *line);
+bool is_valid_utf8(const char *s, size_t n);
+bool check_utf8(Utf8_state *state, const char *s, size_t n);
 void clear_screen(void);
 void quit(void);
-void update_data_file(const Flashcard *list, const char *data_file);
+bool update_data_file(const Flashcard *list, const char *data_file);
+bool write_data_file(const Flashcard *list, const char *filename, int volume);
+bool in_volume(const Flashcard *fc, int volume);
+bool write_record(FILE *fp, Flashcard *fc, const Deck *root);
+void put_string(const char *s, FILE *fp, uint32_t *crc);
+char *format_info(char *buf, const Flashcard *fc);
+char *format_llong(char *p, long long n);
+char *format_ullong(char *p, unsigned long long n);
+char *format_double(char *p, double x);
+void *save_worker(void *arg);
+bool save_shard(const Save_pool *pool, Save_shard *s);
+bool write_shards(int fd, struct iovec *iov, int n, off_t *offset);
+int skip_iov(struct iovec **iov, int n, size_t len);
+void open_shard_writer(Shard_writer *w, int fd);
+void submit_shards(Shard_writer *w, int n);
+void finish_shards(Shard_writer *w);
+bool close_shard_writer(Shard_writer *w);
+void open_aio(Aio *aio, int fd);
+void close_aio(Aio *aio);
+void submit_aio(Aio *aio, int i);
+void wait_aio(Aio *aio, int i);
+void finish_aio(Aio *aio, int i, ssize_t res);
+ssize_t read_all(int fd, char *buf, size_t len, off_t offset);
+#if HAVE_IO_URING
+bool init_uring(Uring *r, unsigned entries);
+void free_uring(Uring *r);
+#endif
+void open_reader(Reader *r, int fd);
+char *read_line(char *line, int size, Reader *r);
 void show_template(void);
 void help(void);
 void *Malloc(size_t size);
+void *Realloc(void *ptr, size_t size);
+void watch(const char *program, int n, char **filenames);
+time_t get_due_time(const char *filename, time_t after, time_t now, int *ndue);
+void scan_watch(Watch *w, int ifd, time_t after);
+void notify_due(const Watch *w, int n, const char *hook);
+int check_files(int n, char **filenames, void (*check)(const char *filename,
+    const char *data, size_t len, FILE *out, int *nerror));
+void *check_worker(void *arg);
+void check_file(Check *check, const Check_pool *pool);
+void check_data(const char *filename, const char *data, size_t len, FILE *out, int *nerror);
+bool is_valid_info(const char *line);
+void scrub_data(const char *filename, const char *data, size_t len, FILE *out, int *nerror);
+int verify_record(const char *record, size_t len);
+void init_crc32c(void);
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+uint32_t crc32c_sw(uint32_t crc, const void *data, size_t len);
+uint32_t crc32c_hw(uint32_t crc, const void *data, size_t len);
+
+/* 選定的譯文表，NULL表示不翻譯 */
+Catalog *catalog=NULL;
 
 /* 以下使用全局變量的目的僅是爲了在程序異常退出時可以釋放資源 */
 Flashcard *flashcards=NULL;
 char *data_file=NULL;
+Arena scratch={NULL};
+int inotify_fd=-1;
+bool data_changed=false; // 事件循環已從inotify_fd讀走了改動事件，尚未處理
+#if HAVE_TIMERFD
+Session session={.tfd=-1, .sfd=-1};
+#endif
+char *journal_file=NULL;
+FILE *journal=NULL;
+Text_cache text_cache;
+#if HAVE_ZLIB
+Packer packer;
+#endif
+
+/* 是否壓縮存放抽認卡的文字 */
+bool compressing=false;
+
+/* 是否在退出時把已形成長時記憶的記錄移入歸檔段 */
+bool archiving=false;
+
+/* 是否在退出時輸出運行統計 */
+bool profiling=false;
+Profile profile;
+
+/* 是否漸進載入數據文件 */
+bool progressive=false;
+#if HAVE_PTHREAD
+Loader loader;
+pthread_t main_thread;
+#endif
+
+/* 收到的SIGINT或SIGTERM，0表示沒有。信號處理函數只設置它，由主線程在能安全
+ * 退出之處查看 */
+volatile sig_atomic_t quit_signal=0;
+
+/* 按復習隊列載入時尚未排序的其餘抽認卡，NULL表示沒有 */
+Flashcard *unsorted=NULL;
+
+/* 數據文件在載入或保存時的狀態，用于察覺外部修改 */
+struct stat data_stat;
+
+/* 數據文件爲分卷清單時的各卷，nvolume爲0表示未分卷 */
+Volume *volumes=NULL;
+int nvolume=0;
+
+/* 按字節分片計算CRC32C的查找表，以及按處理器選定的實現，均由init_crc32c
+ * 在啓動時設定一次，此後各線程只讀 */
+uint32_t crc32c_table[8][256];
+uint32_t (*crc32c_impl)(uint32_t crc, const void *data, size_t len)=crc32c_sw;
 
 int main(int argc, char **argv)
 {
-    set_locale(argv[0]);
-    if(argc != 2)
+    int minutes=0;
+    double start;
+
+    select_catalog();
+    init_crc32c();
+    if(argc>2 && strcmp(argv[1], "watch")==0)
+        watch(argv[0], argc-2, argv+2);
+    if(argc>2 && strcmp(argv[1], "check")==0)
+        return check_files(argc-2, argv+2, check_data);
+    if(argc>2 && strcmp(argv[1], "scrub")==0)
+        return check_files(argc-2, argv+2, scrub_data);
+    if(argc>2 && strcmp(argv[1], "bench")==0)
+        return bench_sort(argc-2, argv+2);
+    if(argc==4 && strcmp(argv[1], "split")==0)
+        return split_data_file(argv[2], argv[3]);
+#if HAVE_ZLIB
+    if(argc==3 && strcmp(argv[1], "export")==0)
+        return export_data_file(argv[2], false);
+    if(argc==3 && strcmp(argv[1], "restore")==0)
+        return export_data_file(argv[2], true);
+#endif
+    if(argc>1 && is_subcommand(argv[1])) // 子命令缺少文件名或參數個數不對
+        usage(argv[0]);
+    for(int i=1; i<argc; i++)
+    {
+        if(strcmp(argv[i], "--minutes") == 0)
+        {
+            char *end=NULL;
+            long n = i+1<argc ? strtol(argv[++i], &end, 10) : 0;
+            if(end==NULL || *end || n<=0 || n>MAX_MINUTES)
+                usage(argv[0]);
+            minutes=n;
+        }
+        else if(strcmp(argv[i], "--cache-size") == 0)
+        {
+            if(i+1==argc || (text_cache.capacity=parse_size(argv[++i]))==0)
+                usage(argv[0]);
+        }
+        else if(strcmp(argv[i], "--profile") == 0)
+            profiling=true;
+        else if(strcmp(argv[i], "--archive") == 0)
+        {
+#if HAVE_ZLIB
+            archiving=true;
+#else
+            die(_("本程序不支持歸檔。\n"));
+#endif
+        }
+        else if(strcmp(argv[i], "--compress") == 0)
+        {
+#if HAVE_ZLIB
+            compressing=true;
+#else
+            die(_("本程序不支持壓縮文字。\n"));
+#endif
+        }
+        else if(strcmp(argv[i], "--progressive") == 0)
+        {
+#if HAVE_PTHREAD
+            progressive=true;
+#else
+            die(_("本程序不支持漸進載入。\n"));
+#endif
+        }
+        else if(argv[i][0]!='-' && data_file==NULL)
+            data_file=argv[i];
+        else
+            usage(argv[0]);
+    }
+    if(data_file==NULL || (progressive && (minutes || text_cache.capacity || compressing)))
         usage(argv[0]);
-    data_file=argv[1];
+    if(compressing && text_cache.capacity==0)
+        text_cache.capacity=PACKED_CACHE_SIZE;
+#if HAVE_PTHREAD
+    main_thread=pthread_self();
+#endif
     set_signal();
     atexit(quit);
+    start=get_seconds();
+#if HAVE_PTHREAD
+    if(progressive)
+        flashcards=start_loading(data_file);
+    else
+#endif
     flashcards=load_flashcard(data_file);
-    quiz(flashcards);
+    profile.load_time=get_seconds()-start;
+    open_journal();
+    watch_data_file();
+#if HAVE_TIMERFD
+    open_session();
+#endif
+    if(minutes)
+        quiz_in_time(flashcards, minutes);
+    else
+        quiz(flashcards);
 
     return EXIT_SUCCESS;
 }
 
-void set_locale(const char *program)
+/* 按環境變量選定內嵌的譯文表，規則與gettext相同：LC_ALL、LC_MESSAGES、LANG中
+ * 第一個非空者爲C或POSIX時不翻譯，否則若設了LANGUAGE則依次查找其列出的各
+ * 語言。只讀環境變量，不調用setlocale，也不打開外部的.mo文件；程序本身不用
+ * 區域設置，解析數據文件中的小數也就不受LC_NUMERIC影響 */
+void select_catalog(void)
 {
-	if(!setlocale(LC_ALL, ""))
-		fprintf(stderr, "warning: no locale support\n");
-    else
-    {
-        bindtextdomain(program, "/usr/share/locale/");
-        textdomain(program);
-    }
+    const char *names[]={"LC_ALL", "LC_MESSAGES", "LANG"};
+    const char *locale=NULL, *language=getenv("LANGUAGE"), *p=NULL;
+    size_t len;
+
+    for(int i=0; i<3 && (locale==NULL || *locale=='\0'); i++)
+        locale=getenv(names[i]);
+    if(locale==NULL || *locale=='\0' || strcmp(locale, "C")==0 || strcmp(locale, "POSIX")==0)
+        return;
+    for(p = language && *language ? language : locale; *p && catalog==NULL; p+=len+(p[len]==':'))
+        len=strcspn(p, ":"), catalog=find_catalog(p, len);
+    if(catalog)
+        qsort(catalog->messages, catalog->n, sizeof(Message), cmp_message);
+}
+
+/* 按語言名查找譯文表。名字形如ll_CC.編碼@修飾，只比較ll_CC部分；只給出ll時
+ * 取該語言的第一個譯文表，如zh取zh_CN */
+Catalog *find_catalog(const char *name, size_t len)
+{
+    size_t n=strcspn(name, ".@:");
+
+    n = n<len ? n : len;
+    for(size_t i=0; i<sizeof(catalogs)/sizeof(Catalog); i++)
+        if(strlen(catalogs[i].lang)==n && strncmp(catalogs[i].lang, name, n)==0)
+            return &catalogs[i];
+    for(size_t i=0; n>0 && memchr(name, '_', n)==NULL && i<sizeof(catalogs)/sizeof(Catalog); i++)
+        if(strncmp(catalogs[i].lang, name, n)==0 && catalogs[i].lang[n]=='_')
+            return &catalogs[i];
+
+    return NULL;
+}
+
+/* 在選定的譯文表中二分查找原文的譯文，找不到時返回原文 */
+const char *translate(const char *msgid)
+{
+    Message key={msgid, NULL}, *m=NULL;
+
+    if(catalog == NULL)
+        return msgid;
+    m=bsearch(&key, catalog->messages, catalog->n, sizeof(Message), cmp_message);
+
+    return m ? m->msgstr : msgid;
+}
+
+int cmp_message(const void *p1, const void *p2)
+{
+    return strcmp(((const Message *)p1)->msgid, ((const Message *)p2)->msgid);
+}
+
+/* 子命令名不作數據文件名 */
+bool is_subcommand(const char *arg)
+{
+    static const char *names[]={"watch", "check", "scrub", "split", "bench",
+        "export", "restore"};
+
+    for(size_t i=0; i<sizeof(names)/sizeof(names[0]); i++)
+        if(strcmp(arg, names[i]) == 0)
+            return true;
+
+    return false;
 }
 
 void usage(const char *program)
 {
-    printf(_("用法：%s <數據文件名>\n"), program);
+    printf(_("用法：%s [選項] <數據文件名>\n"), program);
+    puts(_("選項："));
+    puts(_("    --minutes N    限時N分鐘復習，優先復習單位時間收益最大的抽認卡。"));
+    puts(_("    --cache-size N 低內存模式：抽認卡的文字不常駐內存，按需從數據文件讀入，\n"
+        "                   最多緩存N字節，N可帶K、M、G後綴。"));
+    puts(_("    --profile      退出時輸出載入、保存用時和正文緩存的命中情況。"));
+    puts(_("    --compress     以從數據文件中訓練出的字典壓縮存放抽認卡的文字。"));
+    puts(_("    --archive      退出時把已形成長時記憶、本次又未復習的記錄移入歸檔段\n"
+        "                   “數據文件名.archive”，其後不再載入，也不計入卡組統計。"));
+    puts(_("    --progressive  漸進載入：解析出第一批抽認卡即開始復習，其餘的在後台繼續\n"
+        "                   解析。不能與--minutes、--cache-size或--compress同用。"));
+    printf(_("或：%s watch [--hook 命令] <數據文件名>...\n"), program);
+    puts(_("    在後台監視數據文件，有抽認卡需要復習時發出提醒或執行指定的命令。"));
+    printf(_("或：%s check <數據文件名>...\n"), program);
+    puts(_("    檢查數據文件的格式，按文件和行號報告錯誤。"));
+    printf(_("或：%s scrub <數據文件名>...\n"), program);
+    puts(_("    驗證數據文件中各記錄的校驗和。"));
+    printf(_("或：%s split <數據文件名> <卷數>\n"), program);
+    puts(_("    把數據文件按抽認卡分成若干卷，原文件改寫成列出各卷的清單。此後載入時\n"
+        "    並行解析各卷，保存時只重寫有改動的卷。"));
+    printf(_("或：%s bench <數據文件名>...\n"), program);
+    puts(_("    比較以qsort和基數排序排列抽認卡的用時，並核對兩者的次序是否相同。"));
+#if HAVE_ZLIB
+    printf(_("或：%s export <數據文件名>\n"), program);
+    puts(_("    連同歸檔段中的抽認卡一起輸出整個數據文件。"));
+    printf(_("或：%s restore <數據文件名>\n"), program);
+    puts(_("    把歸檔段中的抽認卡移回數據文件，以便修改或重新復習。"));
+#endif
     puts(_("數據文件格式如下："));
     show_template();
     exit(EXIT_FAILURE);
 } 
 
+/* 不設SA_RESTART，阻塞中的讀入會被信號打斷而返回，以便及時查看quit_signal */
 void set_signal(void)
 {
-	if(signal(SIGINT, exit) == SIG_ERR)
+    struct sigaction sa;
+
+    sa.sa_handler=on_signal, sa.sa_flags=0;
+    sigemptyset(&sa.sa_mask);
+	if(sigaction(SIGINT, &sa, NULL) == -1)
         perror(_("不能安裝SIGINT信號處理函數"));
-	if(signal(SIGTERM, exit) == SIG_ERR)
+	if(sigaction(SIGTERM, &sa, NULL) == -1)
         perror(_("不能安裝SIGTERM信號處理函數"));
 }
 
+void on_signal(int sig)
+{
+    quit_signal=sig;
+}
+
+/* 收到過SIGINT或SIGTERM時經由exit正常退出，由quit保存。只在主線程中、鏈表
+ * 完整時調用 */
+void check_quit(void)
+{
+#if HAVE_PTHREAD
+    if(!pthread_equal(pthread_self(), main_thread))
+        return;
+#endif
+    if(quit_signal)
+        exit(EXIT_SUCCESS);
+}
+
 Flashcard *load_flashcard(const char *filename)
 {
-    char line[LINE_MAX];
-    enum { QUESTION, ANSWER, STATISTICS, IGNORE } stage=IGNORE;
-    FILE *fp=Fopen(filename, "r");
-    Flashcard *fc=NULL;
     Flashcard *list=create_flashcard();
-    time_t cur_time=time(NULL);
+    Index ids;
+    size_t count=0;
+    int n;
 
-    while(fgets(line, LINE_MAX, fp))
-    {
-        if(line[0]=='#' && !has_flashcard(list))
-            list->comment=cat_string(list->comment, line);
-        else if(line[0]=='>' && line[1]=='>')
-            fc=create_flashcard(); 
-        else if(line[0] == '#')
-            fc->comment=cat_string(fc->comment, line);
-        else if(line[0]=='Q' && line[1]==':')
-            stage=QUESTION;
-        else if(line[0]=='A' && line[1]==':')
-            stage=ANSWER;
-        else if(line[0]=='S' && line[1]==':')
-            stage=STATISTICS;
-        else if(line[0]=='<' && line[1]=='<')
-            stage=IGNORE, fix_flashcard(fc), add_flashcard(fc, list, cur_time);
-        else if(stage == QUESTION)
-            fc->question=cat_string(fc->question, line);
-        else if(stage == ANSWER)
-            fc->answer=cat_string(fc->answer, line);
-        else if(stage == STATISTICS)
-            load_info(fc, line);
-    }
-    fclose(fp);
+    list->deck=create_deck("", NULL);
+    if(nvolume || read_manifest(filename))
+        load_volumes(list);
+    else
+        read_data_file(list, filename, 0, NULL, list);
+    for(Flashcard *p=list->next; p; p=p->next)
+        count++;
+    init_index(&ids, count);
+    unique_ids(list->next, &ids);
+    free_index(&ids);
+#if HAVE_ZLIB
+    if(compressing)
+        pack_flashcards(list);
+#endif
+    stat(filename, &data_stat);
+    journal_file=cat_string(cat_string(NULL, filename), ".journal");
+    // 有復習日志待重放時統計信息會變，隊列已不可信；分卷時各卷不一定都重寫，
+    // 與隊列所假定的次序不符
+    if(access(journal_file, F_OK)==0 || nvolume || !(profile.queued=load_queue(list)))
+        sort_flashcard(list);
+    if((n=replay_journal(list, journal_file)))
+        printf(_("已從復習日志中恢復%d次未保存的復習。\n"), n);
 
     return list;
 }
 
-FILE *Fopen(const char *filename, const char *mode)
+/* 讀入數據文件或其第volume卷的頭部注釋和各個抽認卡記錄，把記錄解析出的抽認卡
+ * 加入target；target爲NULL時不安裝，按次序接在list之後，由調用者安裝。若給出
+ * known，則從中取走原文未變的記錄，不再解析。記錄之間的注釋歸入下一個記錄，
+ * 最後一個記錄之後的注釋存入表頭的answer */
+void read_data_file(Flashcard *list, const char *filename, int volume, Index *known,
+    Flashcard *target)
 {
-    FILE *fp=fopen(filename, mode);
-    if(fp == NULL)
+    char line[LINE_MAX], *record=NULL, *pending=NULL;
+    char **dest=NULL; // 上一段歸入之處，過長而分段讀入的行其後各段也歸入此處
+    bool in_header=true, cont=false, bad=false; // 本段是否接續上一段、本行是否已報錯
+    Utf8_state utf8={ 0, 0x80, 0xbf };
+    int fd=open(filename, O_RDONLY);
+    Reader reader;
+    Flashcard *tail = target ? target : list;
+    uint64_t h;
+    size_t body=0; // 記錄本身在record中的起始位置，其前是記錄之間的注釋
+    int lineno=0, start=0;
+    off_t rec_pos=0, pending_pos=0; // 記錄原文、記錄之間的注釋在文件中的位置
+    Flashcard *fc=NULL;
+
+    if(fd == -1)
         die(_("打開文件失敗：%s\n"), filename);
-    return fp;
-}
+    open_reader(&reader, fd);
+    while(tail->next)
+        tail=tail->next;
+    Free(list->comment);
+    Free(list->answer);
+    for(off_t pos=0; read_line(line, LINE_MAX, &reader); pos=reader.offset)
+    {
+        size_t n=strlen(line);
 
-Flashcard *create_flashcard(void)
-{
-    Flashcard *fc=Malloc(sizeof(Flashcard));
-    fc->comment=fc->question=fc->answer=NULL;
-    fc->nquiz=fc->n_contin_right=0;
-    fc->right_rate=0.0;
-    fc->prev_time=fc->next_time=0;
-    fc->next=NULL;
+        if(flashcards == NULL) // 初次載入時還沒有要保存的，可以中途退出
+            check_quit();
+        bool eol = (n>0 && line[n-1]=='\n') || reader.eof; // 以空字符開頭的行長度爲0
 
-    return fc;
+        if(!cont)
+            lineno++, bad=false;
+        if(!check_utf8(&utf8, line, n) || (eol && utf8.need))
+        {
+            if(!bad)
+                fprintf(stderr, _("%s:%d: 不是有效的UTF-8文字\n"), filename, lineno);
+            utf8.need=0, bad=true;
+        }
+        strip_cr(line);
+        if(cont)
+        {
+            if(dest)
+                append_chunk(dest, line);
+        }
+        else if(line[0]=='#' && in_header)
+            list->comment=cat_string(list->comment, line), dest=&list->comment;
+        else if(line[0]=='>' && line[1]=='>')
+        {
+            Free(record), in_header=false, start=lineno, dest=NULL;
+            rec_pos = pending ? pending_pos : pos;
+            record = pending ? pending : cat_string(NULL, "");
+            pending=NULL, body=strlen(record);
+        }
+        else if(line[0]=='<' && line[1]=='<' && record)
+        {
+            if(verify_record(record+body, strlen(record+body)) == 0)
+                fprintf(stderr, _("%s:%d: 記錄校驗失敗\n"), filename, start);
+            h=hash_string(HASH_BASIS, record);
+            if(known==NULL || (fc=take_index(known, h))==NULL)
+            {
+                fc=parse_record(list, record);
+                fc->rec_hash=h, fc->offset=rec_pos, fc->length=pos-rec_pos;
+                fc->volume=volume;
+#if HAVE_PTHREAD
+                if(list == loader.parsed) // 漸進載入時交給前台並入
+                    stage_flashcard(fc);
+                else
+#endif
+                if(target == NULL)
+                    tail=tail->next=fc;
+                else
+                {
+                    tail=install_flashcard(fc, list, tail);
+                    store_text(fc);
+                }
+            }
+            else
+                fc->offset=rec_pos, fc->length=pos-rec_pos, fc->volume=volume;
+            Free(record), dest=NULL;
+        }
+        else if(record)
+            record=cat_string(record, line), dest=&record;
+        else if(line[0] == '#')
+        {
+            if(pending == NULL)
+                pending_pos=pos;
+            pending=cat_string(pending, line), dest=&pending;
+        }
+        else
+            dest=NULL;
+        cont=!eol;
+    }
+    if(utf8.need && !bad) // 文件恰在分段處結束，末尾的字符不完整
+        fprintf(stderr, _("%s:%d: 不是有效的UTF-8文字\n"), filename, lineno);
+    Free(record);
+    list->answer=pending;
+#if HAVE_IO_URING
+    if(reader.aio.use_ring && target==NULL) // 並行載入分卷時由前台匯總
+        volumes[volume].uring=true;
+    else if(reader.aio.use_ring)
+        profile.uring=true;
+#endif
+    close_aio(&reader.aio);
+    if(text_cache.capacity && !compressing) // 留待按需讀入文字，保證讀的是同一個文件
+    {
+        if(text_cache.fp)
+            fclose(text_cache.fp);
+        text_cache.fp=fdopen(fd, "r");
+    }
+    else
+        close(fd);
+    if(list->comment == NULL)
+        list->comment=cat_string(NULL, "");
 }
 
-void free_flashcards(Flashcard *list)
+/* 數據文件的頭部注釋之後若是V:段，則該文件是分卷清單，V:段的各行是各卷的
+ * 文件名，相對路徑相對於清單文件所在的目錄。讀入各卷的文件名，返回是否爲
+ * 分卷清單 */
+bool read_manifest(const char *filename)
 {
-    for(Flashcard *p=list->next, *next=NULL; p; p=next)
+    FILE *fp=fopen(filename, "r");
+    char line[LINE_MAX], *dir=NULL, *p=NULL;
+    bool in_list=false;
+
+    if(fp == NULL)
+        return false;
+    dir=cat_string(NULL, filename);
+    if((p=strrchr(dir, '/')))
+        p[1]='\0';
+    else
+        dir[0]='\0';
+    while(fgets(line, LINE_MAX, fp))
     {
-        next=p->next;
-        del_flashcard(p, list);
-        free_flashcard(p);
+        if(!in_list && (line[0]=='#' || is_blank(line)))
+            continue;
+        else if(!in_list && line[0]=='V' && line[1]==':' && is_blank(line+2))
+            in_list=true;
+        else if(!in_list || (line[0]=='>' && line[1]=='>'))
+            break;
+        else if(!is_blank(line))
+        {
+            Volume *v=NULL;
+            for(p=line; isspace((unsigned char)*p); p++)
+                ;
+            p[strcspn(p, "\r\n")]='\0';
+            volumes=Realloc(volumes, (nvolume+1)*sizeof(Volume));
+            v=volumes+nvolume++;
+            v->filename=cat_string(cat_string(NULL, p[0]=='/' ? "" : dir), p);
+            v->comment=v->trailer=NULL, v->parsed=NULL;
+            v->changed=v->uring=false;
+        }
     }
-    free_flashcard(list);
-}
+    fclose(fp);
+    Free(dir);
+    if(nvolume && text_cache.capacity && !compressing) // 文字不能從各卷讀回
+        die(_("分卷的數據文件不支持低內存模式。\n"));
 
-void free_flashcard(Flashcard *node)
-{
-    Free(node->comment);
-    Free(node->question);
-    Free(node->answer);
-    Free(node);
+    return nvolume > 0;
 }
 
-void add_flashcard(Flashcard *node, Flashcard *list, time_t cur_time)
+/* 把文件名表中的分卷清單換成其各卷的文件名，返回新的文件名表，表中的文件名
+ * 都是新分配的，個數存入*n */
+char **expand_manifests(int *n, char **filenames)
 {
-    Flashcard *p=NULL, *prev=NULL;
-    bool cmp_time = (cur_time > node->next_time);
+    char **names=NULL;
+    int k=0;
 
-    for(p=list->next, prev=list; p; prev=p, p=p->next)
-        if(is_front_flashcard(node, p, cmp_time))
-            break;
+    for(int i=0; i<*n; i++)
+    {
+        if(read_manifest(filenames[i]))
+        {
+            names=Realloc(names, (k+nvolume)*sizeof(char *));
+            for(int j=0; j<nvolume; j++)
+                names[k++]=volumes[j].filename, volumes[j].filename=NULL;
+            free_volumes();
+        }
+        else
+        {
+            names=Realloc(names, (k+1)*sizeof(char *));
+            names[k++]=cat_string(NULL, filenames[i]);
+        }
+    }
+    *n=k;
 
-    prev->next=node, node->next=p;
+    return names;
 }
 
-void del_flashcard(Flashcard *node, Flashcard *list)
+/* 並行解析各卷，再按卷的次序把抽認卡並入鏈表。各卷有各自的卡組樹，並入時換成
+ * 鏈表的卡組樹中的同名卡組 */
+void load_volumes(Flashcard *list)
 {
-    for(Flashcard *p=list->next, *prev=list; p; prev=p, p=p->next)
-        if(p == node)
-            { prev->next=p->next; return; }
+    Volume_pool pool;
+    Flashcard *tail=list;
+
+    pool.next=0;
+    for(int i=0; i<nvolume; i++)
+    {
+        volumes[i].parsed=create_flashcard();
+        volumes[i].parsed->deck=create_deck("", NULL);
+    }
+
+#if HAVE_PTHREAD
+    long nthread=sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t *threads=NULL;
+
+    nthread = nthread<1 ? 1 : (nthread>nvolume ? nvolume : nthread);
+    threads=Malloc(nthread*sizeof(pthread_t));
+    pthread_mutex_init(&pool.mutex, NULL);
+    for(long i=0; i<nthread; i++)
+        if(pthread_create(&threads[i], NULL, volume_worker, &pool))
+            die(_("不能創建線程\n"));
+    for(long i=0; i<nthread; i++)
+        pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&pool.mutex);
+    Free(threads);
+#else
+    volume_worker(&pool);
+#endif
+
+    for(int i=0; i<nvolume; i++)
+    {
+        Volume *v=volumes+i;
+        tail=adopt_flashcards(v->parsed->next, list, tail);
+        Free(v->comment);
+        v->comment=v->parsed->comment, v->parsed->comment=NULL;
+        Free(v->trailer);
+        v->trailer=v->parsed->answer, v->parsed->answer=NULL;
+        free_decks(v->parsed->deck);
+        free_flashcard(v->parsed);
+        v->parsed=NULL;
+        profile.uring = profile.uring || v->uring;
+        stat(v->filename, &v->st);
+    }
+    Free(list->comment);
+    list->comment=cat_string(NULL, "");
 }
 
-void sort_flashcard(Flashcard *list)
+void *volume_worker(void *arg)
 {
-    time_t cur_time=time(NULL);
-    Flashcard *next=NULL, *head=create_flashcard();
-    for(Flashcard *p=list->next; p; p=next)
+    Volume_pool *pool=arg;
+
+    while(1)
     {
-        next=p->next;
-        del_flashcard(p, list);
-        add_flashcard(p, head, cur_time);
+        int i=-1;
+#if HAVE_PTHREAD
+        pthread_mutex_lock(&pool->mutex);
+        if(pool->next < nvolume)
+            i=pool->next++;
+        pthread_mutex_unlock(&pool->mutex);
+#else
+        if(pool->next < nvolume)
+            i=pool->next++;
+#endif
+        if(i < 0)
+            return NULL;
+        read_data_file(volumes[i].parsed, volumes[i].filename, i, NULL, NULL);
     }
-    list->next=head->next;
-    free_flashcard(head);
 }
 
-bool has_flashcard(const Flashcard *list)
+/* 把另一棵卡組樹中解析出而尚未安裝的抽認卡依次接在鏈表的tail之後，所屬卡組
+ * 換成鏈表的卡組樹中的同名卡組，返回新的表尾 */
+Flashcard *adopt_flashcards(Flashcard *fc, const Flashcard *list, Flashcard *tail)
 {
-    return list && list->next;
+    char buf[LINE_MAX];
+
+    for(Flashcard *next=NULL; fc; fc=next)
+    {
+        next=fc->next;
+        if(fc->deck)
+            fc->deck=get_deck(list->deck, format_deck_path(buf, fc->deck));
+        tail=install_flashcard(fc, list, tail);
+    }
+
+    return tail;
 }
 
-bool is_front_flashcard(const Flashcard *fc1, const Flashcard *fc2, bool cmp_time)
+/* 把數據文件按抽認卡標識的散列分成count卷，各卷寫入與數據文件同目錄的
+ * “數據文件名.序號”，再把數據文件改寫成列出各卷的清單。已有同名文件時不分卷 */
+int split_data_file(const char *filename, const char *count)
 {
-    if(is_long_term_memory(fc1))
-        return false;
-    else if(cmp_time && (fc1->next_time < fc2->next_time))
-        return true;
-    else if(cmp_time && (fc1->next_time > fc2->next_time))
-        return false;
-    else if(fc1->n_contin_right < fc2->n_contin_right)
-        return true;
-    else if(fc1->n_contin_right > fc2->n_contin_right)
-        return false;
-    else if(fc1->right_rate < fc2->right_rate)
-        return true;
+    Flashcard *list=create_flashcard();
+    const char *name=strrchr(filename, '/');
+    char num[32], *path=NULL, *tmp=NULL, *end=NULL;
+    long k=strtol(count, &end, 10);
+    FILE *fp=NULL;
+    bool ok=true;
+
+    if(end==count || *end || k<=0 || k>MAX_VOLUME)
+        die(_("卷數應是1到%d之間的整數：%s\n"), MAX_VOLUME, count);
+    int n=k;
+    if(read_manifest(filename))
+        die(_("只能把未分卷的數據文件分成至少一卷：%s\n"), filename);
+    list->deck=create_deck("", NULL);
+    read_data_file(list, filename, 0, NULL, list);
+    stat(filename, &data_stat);
+    volumes=Malloc(n*sizeof(Volume)), nvolume=n;
+    for(int i=0; i<n; i++)
+    {
+        sprintf(num, ".%d", i);
+        volumes[i].filename=cat_string(cat_string(NULL, filename), num);
+        volumes[i].comment=cat_string(NULL, ""), volumes[i].parsed=NULL;
+        volumes[i].trailer=NULL;
+        volumes[i].st=data_stat;
+        if(access(volumes[i].filename, F_OK) == 0)
+            die(_("文件已存在：%s\n"), volumes[i].filename);
+    }
+    for(Flashcard *p=list->next; p; p=p->next)
+        if(p->owner == NULL)
+            p->volume=(p->id>>32)%n; // FNV散列的低位分佈不勻
+    volumes[n-1].trailer=list->answer, list->answer=NULL;
+    for(int i=0; i<n && ok; i++)
+        ok=write_data_file(list, volumes[i].filename, i);
+
+    /* 各卷都已寫好再以清單替換數據文件，中途出錯時數據文件仍完整 */
+    if(ok)
+    {
+        path=realpath(filename, NULL);
+        tmp=cat_string(cat_string(NULL, path ? path : filename), ".tmp");
+        if((fp=fopen(tmp, "w")))
+        {
+            fchmod(fileno(fp), data_stat.st_mode & 07777);
+            fprintf(fp, "%sV:\n", list->comment);
+            for(int i=0; i<n; i++)
+                fprintf(fp, "    %s.%d\n", name ? name+1 : filename, i);
+        }
+        ok = fp && !ferror(fp) && fflush(fp)==0 && fsync(fileno(fp))==0;
+        ok = fp && fclose(fp)==0 && ok && rename(tmp, path ? path : filename)==0;
+        if(ok) // 清單已替換了數據文件，各卷不能再刪
+            sync_parent_dir(path ? path : filename);
+        if(!ok)
+        {
+            fprintf(stderr, _("保存數據文件失敗：%s\n"), filename);
+            remove(tmp);
+        }
+        free(path);
+        Free(tmp);
+    }
+    if(ok)
+        printf(_("已把%s分成%d卷。\n"), filename, n);
     else
-        return false;
+        for(int i=0; i<n; i++)
+            remove(volumes[i].filename);
+    free_flashcards(list);
+    free_volumes();
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-bool is_long_term_memory(const Flashcard *fc)
+void free_volumes(void)
 {
-    return (fc->n_contin_right >= N_LONG_TERM_MEMORY);
+    for(int i=0; i<nvolume; i++)
+    {
+        Free(volumes[i].filename);
+        Free(volumes[i].comment);
+        Free(volumes[i].trailer);
+    }
+    Free(volumes);
+    nvolume=0;
 }
 
-char *cat_string(char *dst, const char *src)
+#if HAVE_ZLIB
+/* 以--archive運行時，把連同派生抽認卡都已形成長時記憶、本次又未復習的記錄作爲
+ * 一個gzip成員追加到歸檔段，並標記爲已歸檔。這些抽認卡不會再被復習，此後只在導出或恢復時
+ * 才讀入。先把歸檔段寫入磁盤再保存數據文件，數據文件保存失敗時記錄兩處都
+ * 有，讀入歸檔段時以數據文件中的爲準 */
+void archive_flashcards(Flashcard *list)
 {
-    if(dst)
-        dst=realloc(dst, strlen(dst)+strlen(src)+1);
-    else
-        dst=Malloc(strlen(src)+1), dst[0]='\0';
-    return strcat(dst, src);
+    char *filename=cat_string(cat_string(NULL, data_file), ARCHIVE_SUFFIX);
+    char *buf=NULL;
+    size_t size=0;
+    FILE *fp=open_memstream(&buf, &size);
+    int fd=-1, n=0;
+    gzFile gz=NULL;
+    bool ok = fp!=NULL, retired;
+    struct stat st;
+
+    for(Flashcard *p=list->next; ok && p; p=p->next)
+    {
+        if(p->owner)
+            continue;
+        retired=true;
+        for(const Flashcard *v=p; v && retired; v=v->variant)
+            retired = is_long_term_memory(v) && !v->dirty;
+        if(retired)
+            ok=write_record(fp, p, list->deck), p->archived=true, n++;
+    }
+    ok = fp && fclose(fp)==0 && ok;
+    if(ok && n)
+    {
+        fd=open(filename, O_WRONLY | O_CREAT | O_APPEND, 0666);
+        if(fd!=-1 && fstat(fd, &st)==0)
+        {
+            if(st.st_size == 0)
+                fchmod(fd, data_stat.st_mode & 07777);
+            gz=gzdopen(dup(fd), "ab");
+            ok = gz && gzwrite(gz, buf, size)==(int)size;
+            ok = gz && gzclose(gz)==Z_OK && ok && fsync(fd)==0;
+            if(!ok && ftruncate(fd, st.st_size)) // 截去寫了一半的成員，以免其後追加的成員讀不出來
+                perror(filename);
+        }
+        else
+            ok=false;
+        if(fd != -1)
+            close(fd);
+    }
+    if(!ok)
+    {
+        fprintf(stderr, _("寫入歸檔段失敗：%s\n"), filename);
+        for(Flashcard *p=list->next; p; p=p->next)
+            p->archived=false;
+    }
+    free(buf);
+    Free(filename);
 }
 
-void load_info(Flashcard *fc, const char *input)
+/* 讀入歸檔段中的記錄，接在list的表尾。原文與list中某個記錄按write_record
+ * 寫出的原文一字不差的記錄，是保存數據文件失敗時兩處都有的同一個記錄，不再
+ * 讀入；問題和答案相同而卡組、注釋或統計信息不同的記錄照常讀入。歸檔段不
+ * 存在時返回true，讀出錯或末尾的記錄不完整時保留已讀入的記錄並返回false */
+bool read_archive(Flashcard *list, const char *filename)
 {
-    sscanf(input, "%d %d %lf", &fc->nquiz, &fc->n_contin_right, &fc->right_rate);
-    fc->prev_time=time(NULL);
+    char line[LINE_MAX], *record=NULL;
+    gzFile gz=gzopen(filename, "rb");
+    Flashcard *tail=list, *fc=NULL;
+    uint64_t h;
+    Index records;
+    size_t n=0;
+    int err=Z_OK;
+    bool complete=true; // 各記錄是否都有記錄結束標記
+
+    if(gz == NULL)
+        return errno == ENOENT;
+    for(Flashcard *p=list->next; p; p=p->next)
+        n++;
+    init_index(&records, n);
+    for(Flashcard *p=list->next; p; tail=p, p=p->next)
+        if(p->owner == NULL)
+            insert_index(&records, hash_record(p, list->deck), p);
+    while(gzgets(gz, line, LINE_MAX))
+    {
+        if(line[0]=='>' && line[1]=='>')
+        {
+            complete = complete && record==NULL;
+            Free(record), record=cat_string(NULL, "");
+        }
+        else if(line[0]=='<' && line[1]=='<' && record)
+        {
+            h=hash_string(HASH_BASIS, record);
+            if(search_index(&records, h) == NULL)
+            {
+                fc=parse_record(list, record);
+                tail=install_flashcard(fc, list, tail);
+                reserve_index(&records, 1); // 歸檔段中的記錄數事先不知道
+                insert_index(&records, h, fc);
+            }
+            Free(record);
+        }
+        else if(record)
+            record=cat_string(record, line);
+    }
+    gzerror(gz, &err);
+    gzclose(gz);
+    free_index(&records);
+    complete = complete && record==NULL; // 缺少結束標記的記錄不能當作已讀回
+    Free(record);
+
+    return err==Z_OK && complete;
 }
 
-void fix_flashcard(Flashcard *fc)
+/* 返回抽認卡記錄按write_record寫出時記錄開始與結束標記之間的原文的散列值，
+ * 與讀入歸檔段時由記錄原文算出的可以比較。讀不回文字時返回0 */
+uint64_t hash_record(Flashcard *fc, const Deck *root)
 {
-    if(fc->comment == NULL)
-        fc->comment=cat_string(NULL, "");
-    if(fc->question == NULL)
-        fc->question=cat_string(NULL, "\n");
-    if(fc->answer == NULL)
-        fc->answer=cat_string(NULL, "\n");
+    const size_t head=strlen("\n>>\n"), tail=strlen("<<\n");
+    char *buf=NULL;
+    size_t size=0;
+    FILE *fp=open_memstream(&buf, &size);
+    uint64_t h=0;
+    bool ok;
 
-    if(fc->prev_time == 0)
-        fc->prev_time=time(NULL);
+    if(fp == NULL)
+        die(_("錯誤：內存不足！"));
+    ok=write_record(fp, fc, root);
+    if(fclose(fp)==0 && ok && size>=head+tail)
+    {
+        buf[size-tail]='\0';
+        h=hash_string(HASH_BASIS, buf+head);
+    }
+    free(buf);
 
-    struct tm *p=gmtime(&fc->prev_time);
-    if(p->tm_mon < 11)
-        p->tm_mon++;
+    return h;
+}
+
+/* 把數據文件連同歸檔段中的抽認卡輸出到標準輸出；restore爲真時改爲寫回數據
+ * 文件，歸檔段中的記錄都已完整讀入並寫回之後才刪除歸檔段 */
+int export_data_file(const char *filename, bool restore)
+{
+    Flashcard *list=create_flashcard();
+    char *archive=cat_string(cat_string(NULL, filename), ARCHIVE_SUFFIX);
+    bool ok=true;
+
+    list->deck=create_deck("", NULL);
+    if(read_manifest(filename))
+    {
+        if(restore)
+            die(_("分卷的數據文件沒有歸檔段：%s\n"), filename);
+        load_volumes(list);
+    }
     else
-        p->tm_mon=0, p->tm_year++;
-    fc->next_time=mktime(p);
+        read_data_file(list, filename, 0, NULL, list);
+    stat(filename, &data_stat);
+    if(!read_archive(list, archive))
+        die(_("讀取歸檔段失敗：%s\n"), archive);
+    if(restore)
+        ok = write_data_file(list, filename, -1) && (remove(archive)==0 || errno==ENOENT);
+    else
+    {
+        fputs(list->comment, stdout);
+        for(Flashcard *p=list->next; p && ok; p=p->next)
+            if(p->owner == NULL)
+                ok=write_record(stdout, p, list->deck);
+        if(list->answer)
+            fputs(list->answer, stdout);
+        ok = fflush(stdout)==0 && ok;
+    }
+    free_flashcards(list);
+    free_volumes();
+    Free(archive);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
+#endif
 
-void quiz(Flashcard *list)
+#if HAVE_PTHREAD
+/* 漸進載入：後台線程解析數據文件，前台等到第一批抽認卡即開始復習，其餘的
+ * 在每答完一題後並入鏈表。有與數據文件相符的復習隊列時，第一批要等到隊列中
+ * 的抽認卡都已並入，這些是上次保存時排在最前的，首題因此與完整載入時相同；
+ * 沒有時第一批只是數據文件開頭的抽認卡。有復習日志待重放或數據文件分卷時
+ * 仍完整載入 */
+Flashcard *start_loading(const char *filename)
 {
-    if(!has_flashcard(list))
+    char *journal_name=cat_string(cat_string(NULL, filename), ".journal");
+    bool has_journal=access(journal_name, F_OK)==0;
+    Flashcard *list=NULL;
+    sigset_t set, old;
+    uint64_t total;
+
+    Free(journal_name);
+    if(has_journal || read_manifest(filename))
+        return load_flashcard(filename);
+    fclose(Fopen(filename, "r")); // 在前台報告打不開的文件
+
+    list=create_flashcard();
+    list->deck=create_deck("", NULL);
+    list->comment=cat_string(NULL, "");
+    loader.parsed=create_flashcard();
+    loader.parsed->deck=create_deck("", NULL);
+    loader.pending=loader.staged=NULL, loader.npending=0;
+    loader.filename=filename, loader.done=false, loader.running=true;
+    loader.start=get_seconds();
+    stat(filename, &data_stat);
+    journal_file=cat_string(cat_string(NULL, filename), ".journal");
+    if((profile.queued = (loader.seed=read_queue(&loader.nseed, &total))!=NULL))
+        qsort(loader.seed, loader.nseed, sizeof(uint64_t), cmp_id);
+    loader.missing=loader.nseed;
+    init_index(&loader.ids, LOAD_BATCH);
+
+    pthread_mutex_init(&loader.mutex, NULL);
+    pthread_cond_init(&loader.cond, NULL);
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT), sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, &old); // 信號只交給前台處理
+    if(pthread_create(&loader.thread, NULL, load_worker, NULL))
+        die(_("不能創建線程\n"));
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    merge_loaded(list, true);
+    while(loader.running && loader.missing)
+        check_quit(), merge_loaded(list, true);
+    Free(loader.seed), loader.nseed=loader.missing=0;
+    profile.first_time=get_seconds()-loader.start;
+
+    return list;
+}
+
+void *load_worker(void *arg)
+{
+    (void)arg;
+    read_data_file(loader.parsed, loader.filename, 0, NULL, loader.parsed);
+    publish_loaded(true);
+    return NULL;
+}
+
+/* 新解析出的抽認卡攢夠一批再交給前台，以免頻繁加鎖 */
+void stage_flashcard(Flashcard *fc)
+{
+    if(loader.pending)
+        loader.pending_tail->next=fc;
+    else
+        loader.pending=fc;
+    loader.pending_tail=fc;
+    if(++loader.npending == LOAD_BATCH)
+        publish_loaded(false);
+}
+
+void publish_loaded(bool done)
+{
+    pthread_mutex_lock(&loader.mutex);
+    if(loader.pending)
     {
-        free_flashcard(list);
-        die(_("數據文件不包含有效的抽認卡記錄！\n"));
+        if(loader.staged)
+            loader.staged_tail->next=loader.pending;
+        else
+            loader.staged=loader.pending;
+        loader.staged_tail=loader.pending_tail;
     }
+    loader.pending=NULL, loader.npending=0;
+    loader.done=done;
+    pthread_cond_broadcast(&loader.cond);
+    pthread_mutex_unlock(&loader.mutex);
+}
 
-    bool right;
-    for(Flashcard *p=list->next; p; p=p->next)
+/* 把已交出的抽認卡並入鏈表，wait爲真時先等到有新抽認卡或已全部解析完畢。
+ * 新抽認卡先自行排好序，再與鏈表歸併。返回是否並入了新抽認卡 */
+bool merge_loaded(Flashcard *list, bool wait)
+{
+    Flashcard *added=create_flashcard(), *fc=NULL;
+    bool done, merged;
+    size_t n=0;
+
+    pthread_mutex_lock(&loader.mutex);
+    while(wait && loader.staged==NULL && !loader.done)
+        pthread_cond_wait(&loader.cond, &loader.mutex);
+    fc=loader.staged, loader.staged=NULL, done=loader.done;
+    pthread_mutex_unlock(&loader.mutex);
+
+    adopt_flashcards(fc, list, added);
+    for(Flashcard *p=added->next; p; p=p->next)
+        n++;
+    reserve_index(&loader.ids, n);
+    unique_ids(added->next, &loader.ids); // 各批按數據文件中的次序並入
+    for(Flashcard *p=added->next; loader.missing && p; p=p->next)
+        if(bsearch(&p->id, loader.seed, loader.nseed, sizeof(uint64_t), cmp_id))
+            loader.missing--;
+    merged = added->next!=NULL;
+    sort_flashcard(added);
+    merge_sorted(list, added);
+    free_flashcard(added);
+    if(done)
+        end_loading(list);
+
+    return merged;
+}
+
+/* 等解析線程讀完數據文件，一次並入其餘的抽認卡 */
+void finish_loading(Flashcard *list)
+{
+    pthread_mutex_lock(&loader.mutex);
+    while(!loader.done)
+        pthread_cond_wait(&loader.cond, &loader.mutex);
+    pthread_mutex_unlock(&loader.mutex);
+    merge_loaded(list, false);
+}
+
+/* 解析線程已讀完數據文件：回收之，並接過數據文件的頭部注釋 */
+void end_loading(Flashcard *list)
+{
+    pthread_join(loader.thread, NULL);
+    pthread_cond_destroy(&loader.cond);
+    pthread_mutex_destroy(&loader.mutex);
+    Free(list->comment);
+    list->comment=loader.parsed->comment, loader.parsed->comment=NULL;
+    Free(list->answer);
+    list->answer=loader.parsed->answer, loader.parsed->answer=NULL;
+    free_decks(loader.parsed->deck);
+    free_flashcard(loader.parsed);
+    loader.parsed=NULL, loader.running=false;
+    free_index(&loader.ids);
+    profile.load_time=get_seconds()-loader.start;
+}
+
+int cmp_id(const void *p1, const void *p2)
+{
+    uint64_t id1=*(const uint64_t *)p1, id2=*(const uint64_t *)p2;
+
+    return id1<id2 ? -1 : id1>id2;
+}
+#endif
+
+/* 把已排好序的src中的抽認卡歸併到list中。list中已復習過的抽認卡的統計信息
+ * 已變，不再有序，故不參與比較，原位不動。排序鍵相同時list中的在前，即先解析
+ * 出的或在復習隊列中的在前，與一次排好序的次序相同 */
+void merge_sorted(Flashcard *list, Flashcard *src)
+{
+    time_t cur_time=time(NULL);
+    Sort_key k1, k2;
+    Flashcard *p=list;
+
+    for(; p->next && src->next; p=p->next)
     {
-        if(is_long_term_memory(p))
+        Flashcard *fc=src->next;
+        if(p->next->dirty)
             continue;
-        show_question(p->question);
-        input_question();
-        show_answer(p->answer);
-        right=judge_answer();
-        eval_answer(p, right);
-        update_statistics(list, right);
+        make_sort_key(&k1, fc, 0, cur_time);
+        make_sort_key(&k2, p->next, 0, cur_time);
+        if(cmp_sort_key(&k1, &k2) < 0)
+            src->next=fc->next, fc->next=p->next, p->next=fc;
     }
-    puts(_("復習完成。"));
-    show_statistics(list);
+    if(src->next)
+        p->next=src->next, src->next=NULL;
 }
 
-void show_quiz_result(const Flashcard *list)
+/* 復習隊列文件依次爲：開頭標記；保存後數據文件的長度、修改時間（秒和納秒）、
+ * i節點號和抽認卡總數；保存當天的紀元日；隊列長度；隊列中各抽認卡的標識
+ * （8字節，小端序）和下次復習日與保存當天相差的天數；末尾是此前全部內容的
+ * CRC32C（4字節，小端序）。除標識和校驗和外都是變長整數，天數以zigzag編碼。
+ * 數據文件與記下的狀態不符或抽認卡對不上時不用隊列，照常排序 */
+bool load_queue(Flashcard *list)
 {
-    for(Flashcard *p=list->next; p; p=p->next)
+    size_t k=0, n=0, nqueue=0;
+    uint64_t total, *queued=read_queue(&k, &total);
+    Flashcard **queue=NULL, *tail=NULL, *rest=NULL;
+    Index ids;
+    bool ok;
+
+    for(Flashcard *q=list->next; queued && q; q=q->next)
+        n++;
+    if(queued==NULL || n!=total || k>n)
     {
-        if(is_long_term_memory(p))
-            continue;
+        Free(queued);
+        return false;
+    }
+    init_index(&ids, n);
+    for(Flashcard *q=list->next; q; q=q->next)
+        insert_index(&ids, q->id, q);
+    queue=Malloc((k ? k : 1)*sizeof(Flashcard *));
+    for(; nqueue<k; nqueue++)
+        if((queue[nqueue]=take_index(&ids, queued[nqueue])) == NULL
+            || take_index(&ids, queued[nqueue])) // 標識重複時分不清是哪一個
+            break;
+    if((ok = nqueue==k))
+    {
+        unsorted=rest=create_flashcard();
+        for(Flashcard *q=list->next; q; q=q->next)
+            if(!find_index(&ids, q->id, q)->taken)
+                rest=rest->next=q;
+        rest->next=NULL;
+        if(unsorted->next == NULL)
+            free_flashcard(unsorted), unsorted=NULL;
+        tail=list;
+        for(size_t i=0; i<k; i++)
+            tail=tail->next=queue[i];
+        tail->next=NULL;
     }
+    free_index(&ids);
+    Free(queue);
+    Free(queued);
+
+    return ok;
 }
 
-void show_question(const char *question)
+/* 讀入復習隊列文件並核對數據文件的狀態，返回隊列中各抽認卡的標識，其個數
+ * 存入*k，抽認卡總數存入*total。文件不存在、已損壞或與數據文件不符時返回
+ * NULL */
+uint64_t *read_queue(size_t *k, uint64_t *total)
 {
-    puts(_("問題："));
-    printf("%s", question);
-    puts(_("請輸入答案（以獨立一行<<<結束）："));
-    get_sys_cmd_and_exec(question);
+    char *filename=cat_string(cat_string(NULL, data_file), ".queue");
+    FILE *fp=fopen(filename, "rb");
+    size_t max=64+QUEUE_SIZE*(8+10), len=0, n=0;
+    unsigned char *buf=NULL;
+    const unsigned char *p=NULL, *end=NULL;
+    uint64_t size, mtime, nsec, ino, day, count=0, delta, *ids=NULL;
+    bool ok=false;
+
+    Free(filename);
+    if(fp == NULL)
+        return NULL;
+    buf=Malloc(max);
+    len=fread(buf, 1, max, fp);
+    fclose(fp);
+    if(len>=8 && len<max && memcmp(buf, QUEUE_MAGIC, 4)==0)
+    {
+        p=buf+4, end=buf+len-4;
+        ok = crc32c(0, buf, len-4) == (end[0] | (uint32_t)end[1]<<8
+            | (uint32_t)end[2]<<16 | (uint32_t)end[3]<<24)
+            && get_varint(&p, end, &size) && get_varint(&p, end, &mtime)
+            && get_varint(&p, end, &nsec) && get_varint(&p, end, &ino)
+            && get_varint(&p, end, total) && get_varint(&p, end, &day)
+            && get_varint(&p, end, &count) && count<=QUEUE_SIZE
+            && size==(uint64_t)data_stat.st_size && mtime==(uint64_t)data_stat.st_mtime
+            && nsec==(uint64_t)data_stat.st_mtim.tv_nsec && ino==(uint64_t)data_stat.st_ino;
+    }
+    if(ok)
+        ids=Malloc((count ? count : 1)*sizeof(uint64_t));
+    for(; ok && n<count && end-p>=8; n++)
+    {
+        ids[n]=0;
+        for(int i=7; i>=0; i--)
+            ids[n]=ids[n]<<8 | p[i];
+        p+=8;
+        if(!get_varint(&p, end, &delta)) // 下次復習日只供查看，載入時不用
+            break;
+    }
+    if(!ok || n!=count || p!=end)
+        Free(ids);
+    else
+        *k=count;
+    Free(buf);
+
+    return ids;
 }
 
-void input_question(void)
+/* 把按復習隊列載入時暫未排序的其餘抽認卡並入鏈表。sort爲假時直接接在表尾，
+ * 供隨後要整體排序的調用者使用 */
+void merge_unsorted(Flashcard *list, bool sort)
 {
-    char line[LINE_MAX];
-    while(fgets(line, LINE_MAX, stdin))
+    Flashcard *p=list;
+
+    if(unsorted == NULL)
+        return;
+    if(sort)
+        sort_flashcard(unsorted), merge_sorted(list, unsorted);
+    else
     {
-        if(strcmp(line, "<<<\n") == 0)
-            return;
-        exec_cmd(line);
+        while(p->next)
+            p=p->next;
+        p->next=unsorted->next, unsorted->next=NULL;
     }
+    free_flashcard(unsorted);
+    unsorted=NULL;
 }
 
-void show_answer(const char *answer)
+/* 數據文件保存後，選出下次啓動時排在最前的QUEUE_SIZE個抽認卡，寫入復習隊列
+ * 文件。下次啓動時各抽認卡的下次復習時間都重設在一個月後，沒有已到復習時間
+ * 的，故以0爲當前時間生成排序鍵；正確率按數據文件中寫下的精度比較；抽認卡
+ * 按數據文件中的次序編號，派生抽認卡中填空抽認卡在前、反向抽認卡在後，與
+ * 重新載入時的次序相同 */
+void save_queue(const Flashcard *list)
 {
-    puts(_("答案："));
-    printf("%s", answer);
-    get_sys_cmd_and_exec(answer);
+    char *filename=cat_string(cat_string(NULL, data_file), ".queue");
+    char *tmp=cat_string(cat_string(NULL, filename), ".tmp");
+    char num[32];
+    size_t k=0, seq=0;
+    Sort_key *heap=Malloc(QUEUE_SIZE*sizeof(Sort_key)), key;
+    unsigned char *buf=Malloc(64+QUEUE_SIZE*(8+10)+4), *p=buf;
+    long long today=epoch_day(time(NULL));
+    uint32_t crc;
+    FILE *fp=NULL;
+    bool ok;
+
+    for(Flashcard *fc=list->next; fc; fc=fc->next)
+        for(int reverse=0; fc->owner==NULL && !fc->archived && reverse<2; reverse++)
+            for(Flashcard *v=fc; v; v=v->variant)
+            {
+                if(v->reverse != reverse)
+                    continue;
+                make_sort_key(&key, v, seq++, 0);
+                *format_double(num, v->right_rate)='\0';
+                key.right_rate=strtod(num, NULL);
+                if(k < QUEUE_SIZE)
+                {
+                    heap[k++]=key;
+                    if(k == QUEUE_SIZE)
+                        for(size_t i=k/2; i-- > 0; )
+                            sift_queue(heap, k, i);
+                }
+                else if(cmp_sort_key(&key, heap) < 0)
+                    heap[0]=key, sift_queue(heap, k, 0);
+            }
+    qsort(heap, k, sizeof(Sort_key), cmp_sort_key);
+
+    memcpy(p, QUEUE_MAGIC, 4), p+=4;
+    p=put_varint(p, data_stat.st_size);
+    p=put_varint(p, data_stat.st_mtime);
+    p=put_varint(p, data_stat.st_mtim.tv_nsec);
+    p=put_varint(p, data_stat.st_ino);
+    p=put_varint(p, seq);
+    p=put_varint(p, today);
+    p=put_varint(p, k);
+    for(size_t i=0; i<k; i++)
+    {
+        long long delta=epoch_day(heap[i].fc->next_time)-today;
+        for(int j=0; j<8; j++)
+            *p++=heap[i].fc->id>>8*j;
+        p=put_varint(p, delta<0 ? ~((uint64_t)delta<<1) : (uint64_t)delta<<1);
+    }
+    crc=crc32c(0, buf, p-buf);
+    for(int j=0; j<4; j++)
+        *p++=crc>>8*j;
+
+    fp=fopen(tmp, "wb");
+    ok = fp && fwrite(buf, 1, p-buf, fp)==(size_t)(p-buf);
+    ok = fp && fclose(fp)==0 && ok && rename(tmp, filename)==0;
+    if(!ok)
+    {
+        fprintf(stderr, _("保存復習隊列失敗：%s\n"), filename);
+        remove(tmp);
+    }
+    Free(heap);
+    Free(buf);
+    Free(tmp);
+    Free(filename);
 }
 
-bool judge_answer(void)
+/* 把堆中第i個元素下沉到合適的位置，堆頂爲排序鍵最大者 */
+void sift_queue(Sort_key *heap, size_t n, size_t i)
 {
-    char line[LINE_MAX];
-    while(1)
+    for(size_t child; (child=2*i+1) < n; i=child)
     {
-        puts(_("是否正確？(正確按y/錯誤按n）"));
-        fgets(line, LINE_MAX, stdin);
-        exec_cmd(line);
-        if(strcmp(line, "y\n") == 0)
+        if(child+1<n && cmp_sort_key(heap+child+1, heap+child) > 0)
+            child++;
+        if(cmp_sort_key(heap+child, heap+i) <= 0)
+            break;
+        Sort_key t=heap[i];
+        heap[i]=heap[child], heap[child]=t;
+    }
+}
+
+/* 寫入n的變長編碼，每字節存7位，低位在前，最高位表示後面還有字節 */
+unsigned char *put_varint(unsigned char *p, uint64_t n)
+{
+    for(; n >= 0x80; n>>=7)
+        *p++=(n&0x7f) | 0x80;
+    *p++=n;
+    return p;
+}
+
+bool get_varint(const unsigned char **p, const unsigned char *end, uint64_t *n)
+{
+    *n=0;
+    for(int shift=0; *p<end && shift<64; shift+=7)
+    {
+        *n |= (uint64_t)(**p & 0x7f) << shift;
+        if((*(*p)++ & 0x80) == 0)
             return true;
-        if(strcmp(line, "n\n") == 0)
-            return false;
     }
+    return false;
 }
 
-void eval_answer(Flashcard *fc, bool right)
+/* 時間所在的日子距1970年1月1日的天數（UTC） */
+long long epoch_day(time_t t)
 {
-    update_statistics(fc, right);
-    show_statistics(fc);
+    long long s=t;
+    return s>=0 ? s/86400 : -((-s+86399)/86400);
 }
 
-void update_statistics(Flashcard *fc, bool right)
+/* 解析記錄開始標記和記錄結束標記之間的內容 */
+Flashcard *parse_record(Flashcard *list, const char *record)
 {
-    double rate=fc->right_rate, n=fc->nquiz;
+    char line[LINE_MAX];
+    enum { DECK, QUESTION, ANSWER, STATISTICS, REVERSE, IGNORE } stage=IGNORE;
+    Flashcard *fc=create_flashcard();
+    int ninfo=0;
 
-    fc->nquiz++;
-    fc->n_contin_right = right ? fc->n_contin_right+1 : 0;
+    for(const char *p=record, *end=NULL; *p; p=end)
+    {
+        end=strchr(p, '\n');
+        end = end ? end+1 : p+strlen(p);
+        if(end-p > LINE_MAX-1) // 與read_line一樣把過長的行分段處理
+            end=p+LINE_MAX-1;
+        memcpy(line, p, end-p), line[end-p]='\0';
 
-    if(right)
-        fc->right_rate=(rate*n+100)/(n+1);
-    else if(rate > 0)
-        fc->right_rate=(rate*n-100)/(n+1);
+        if(line[0] == '#')
+            fc->comment=cat_string(fc->comment, line);
+        else if(line[0]=='D' && line[1]==':')
+            stage=DECK;
+        else if(line[0]=='Q' && line[1]==':')
+            stage=QUESTION;
+        else if(line[0]=='A' && line[1]==':')
+            stage=ANSWER;
+        else if(line[0]=='S' && line[1]==':')
+            stage=STATISTICS, ninfo=0;
+        else if(line[0]=='R' && line[1]==':')
+            stage=REVERSE, append_variant(fc, create_reverse_flashcard(fc));
+        else if(line[0]=='C' && line[1]==':')
+            stage=IGNORE, fc->checksum=true;
+        else if(stage == DECK)
+            load_deck(fc, list->deck, line);
+        else if(stage == QUESTION)
+            fc->question=cat_string(fc->question, line);
+        else if(stage == ANSWER)
+            fc->answer=cat_string(fc->answer, line);
+        else if(stage==STATISTICS && !is_blank(line))
+        {
+            Flashcard *v=get_cloze_flashcard(fc, ninfo++);
+            char *s=line+strspn(line, " \t");
+            if(s[0]=='c' && isdigit((unsigned char)s[1])) // 帶填空序號的統計信息
+                v->cloze=strtol(s+1, &s, 10);
+            load_info(v, s);
+        }
+        else if(stage == REVERSE)
+            for(Flashcard *v=fc->variant; v; v=v->variant)
+                if(v->reverse)
+                    load_info(v, line);
+    }
+
+    return fc;
+}
+
+/* 低內存模式下確保抽認卡的文字已讀入，並把最久未用的記錄的文字逐出緩存，
+ * 直到用量不超過上限。剛用到的記錄不會被逐出，故取得的文字可以一直使用到
+ * 下一次調用本函數爲止。讀不回原文時以空文字代替並返回false */
+bool load_text(Flashcard *fc)
+{
+    Flashcard *owner = fc->owner ? fc->owner : fc;
+    Cache_entry *e=owner->cached;
+
+    if(text_cache.capacity == 0)
+        return true;
+    if(e)
+    {
+        text_cache.hits++;
+        unlink_cache_entry(e);
+    }
     else
-        fc->right_rate=0;
+    {
+        text_cache.misses++;
+        release_text(owner); // 可能留有讀取失敗時的空文字
+#if HAVE_ZLIB
+        if(owner->block)
+            unpack_text(owner);
+        else
+#endif
+        if(!read_text(owner))
+        {
+            Free(owner->comment), Free(owner->question), Free(owner->answer);
+            fix_text(owner);
+            link_text(owner);
+            return false;
+        }
+        e=owner->cached=Malloc(sizeof(Cache_entry));
+        e->owner=owner;
+        e->size=sizeof(Cache_entry)+strlen(owner->comment)
+            +strlen(owner->question)+strlen(owner->answer)+3;
+        text_cache.size+=e->size;
+    }
+
+    e->prev=NULL, e->next=text_cache.head;
+    if(text_cache.head)
+        text_cache.head->prev=e;
+    else
+        text_cache.tail=e;
+    text_cache.head=e;
+    while(text_cache.size>text_cache.capacity && text_cache.tail!=e)
+        text_cache.evictions++, release_text(text_cache.tail->owner);
+    if(text_cache.size > text_cache.peak)
+        text_cache.peak=text_cache.size;
+
+    return true;
+}
+
+/* 從數據文件中讀回記錄原文，按read_data_file的方式拼出記錄之間的注釋和記錄
+ * 本身，核對散列值後取出其中的文字 */
+bool read_text(Flashcard *owner)
+{
+    char line[LINE_MAX], *buf=Malloc(owner->length+1), *record=NULL;
+    bool in_record=false, cont=false, kept=false, ok; // 本段是否接續上一段、所在行是否取用
+    FILE *fp=NULL;
+
+    ok = fseeko(text_cache.fp, owner->offset, SEEK_SET)==0
+        && fread(buf, 1, owner->length, text_cache.fp)==owner->length
+        && (fp=fmemopen(buf, owner->length, "r"))!=NULL;
+    record=cat_string(NULL, "");
+    while(ok && fgets(line, LINE_MAX, fp)) // 與載入時一樣分段處理，散列值才相符
+    {
+        size_t n=strip_cr(line);
+
+        if(cont)
+        {
+            if(kept)
+                append_chunk(&record, line);
+        }
+        else if(in_record || line[0]=='#')
+            record=cat_string(record, line), kept=true;
+        else if(line[0]=='>' && line[1]=='>')
+            in_record=true, kept=false;
+        else
+            kept=false;
+        cont = n==0 || line[n-1]!='\n';
+    }
+    if(fp)
+        fclose(fp);
+    Free(buf);
+
+    ok = ok && hash_string(HASH_BASIS, record)==owner->rec_hash;
+    if(ok)
+        parse_text(owner, record);
+    else
+        fprintf(stderr, _("數據文件已被修改，不能讀回抽認卡的文字：%s\n"), data_file);
+    Free(record);
+
+    return ok;
+}
+
+/* 取出記錄中的注釋、問題和答案，分段方式與parse_record相同 */
+void parse_text(Flashcard *owner, const char *record)
+{
+    char line[LINE_MAX];
+    enum { QUESTION, ANSWER, IGNORE } stage=IGNORE;
+
+    for(const char *p=record, *end=NULL; *p; p=end)
+    {
+        end=strchr(p, '\n');
+        end = end ? end+1 : p+strlen(p);
+        if(end-p > LINE_MAX-1)
+            end=p+LINE_MAX-1;
+        memcpy(line, p, end-p), line[end-p]='\0';
+
+        if(line[0] == '#')
+            owner->comment=cat_string(owner->comment, line);
+        else if(line[0]=='Q' && line[1]==':')
+            stage=QUESTION;
+        else if(line[0]=='A' && line[1]==':')
+            stage=ANSWER;
+        else if(line[1]==':' && strchr("DSRC", line[0]))
+            stage=IGNORE;
+        else if(stage == QUESTION)
+            owner->question=cat_string(owner->question, line);
+        else if(stage == ANSWER)
+            owner->answer=cat_string(owner->answer, line);
+    }
+    fix_text(owner);
+    link_text(owner);
+}
+
+/* 釋放抽認卡的文字，低內存模式下之後可由load_text重新讀入 */
+void release_text(Flashcard *owner)
+{
+    uncache_text(owner);
+    Free(owner->comment);
+    Free(owner->question);
+    Free(owner->answer);
+    link_text(owner);
+}
+
+void uncache_text(Flashcard *owner)
+{
+    if(owner->cached == NULL)
+        return;
+    unlink_cache_entry(owner->cached);
+    text_cache.size-=owner->cached->size;
+    Free(owner->cached);
+}
+
+void unlink_cache_entry(Cache_entry *e)
+{
+    if(e->prev)
+        e->prev->next=e->next;
+    else
+        text_cache.head=e->next;
+    if(e->next)
+        e->next->prev=e->prev;
+    else
+        text_cache.tail=e->prev;
+}
+
+/* 令派生抽認卡的文字指向原抽認卡的文字，反向抽認卡則互換問題和答案 */
+void link_text(Flashcard *owner)
+{
+    for(Flashcard *p=owner->variant; p; p=p->variant)
+    {
+        p->comment=owner->comment;
+        p->question = p->reverse ? owner->answer : owner->question;
+        p->answer = p->reverse ? owner->question : owner->answer;
+    }
+}
+
+/* 解析帶K、M、G後綴的字節數，無效時返回0 */
+size_t parse_size(const char *s)
+{
+    char *end=NULL;
+    unsigned long long n=strtoull(s, &end, 10);
+
+    if(end==s || *s=='-')
+        return 0;
+    switch(toupper((unsigned char)*end))
+    {
+        case 'G': n*=1024; /* fall through */
+        case 'M': n*=1024; /* fall through */
+        case 'K': n*=1024, end++; break;
+    }
+    return *end ? 0 : n;
+}
+
+double get_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+void show_profile(void)
+{
+    fprintf(stderr, _("載入用時：%.3f秒\n"), profile.load_time);
+    fprintf(stderr, _("保存用時：%.3f秒\n"), profile.save_time);
+    fprintf(stderr, _("數據文件讀取方式：%s\n"), profile.uring ? "io_uring" : "pread");
+    fprintf(stderr, _("數據文件寫入方式：%s\n"), profile.save_uring ? "io_uring" : "pwritev");
+    if(progressive)
+        fprintf(stderr, _("首題等待：%.3f秒\n"), profile.first_time);
+    if(profile.queued)
+        fputs(_("載入時沿用了上次保存的復習隊列。\n"), stderr);
+    if(text_cache.capacity)
+        fprintf(stderr, _("正文緩存：命中%lu次，未命中%lu次，淘汰%lu次，"
+            "峰值%zu字節，上限%zu字節\n"), text_cache.hits, text_cache.misses,
+            text_cache.evictions, text_cache.peak, text_cache.capacity);
+#if HAVE_ZLIB
+    if(compressing)
+        fprintf(stderr, _("壓縮文字：原文%zu字節，壓縮後%zu字節，字典%zu字節\n"),
+            packer.raw_total, packer.packed_total, packer.dict_len);
+#endif
+}
+
+/* 新解析出的記錄的文字不常駐內存時，壓縮之或釋放之。壓縮模式下載入數據文件
+ * 時還沒有字典，文字暫留內存，待讀完後由pack_flashcards統一訓練字典並壓縮 */
+void store_text(Flashcard *owner)
+{
+#if HAVE_ZLIB
+    if(compressing)
+    {
+        if(packer.ready)
+            pack_texts(&owner, 1);
+        return;
+    }
+#endif
+    if(text_cache.capacity)
+        release_text(owner);
+}
+
+#if HAVE_ZLIB
+/* 訓練字典，然後按文件中的次序把相鄰記錄的文字分塊壓縮 */
+void pack_flashcards(Flashcard *list)
+{
+    size_t n=0, size=64, raw=0;
+    Flashcard **owners=Malloc(size*sizeof(Flashcard *));
+
+    train_dictionary(list);
+    if(deflateInit2(&packer.deflater, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 9,
+        Z_DEFAULT_STRATEGY) != Z_OK || inflateInit2(&packer.inflater, -15) != Z_OK)
+        die(_("壓縮抽認卡的文字失敗\n"));
+    packer.ready=true;
+
+    for(Flashcard *p=list->next; p; p=p->next)
+    {
+        if(p->owner)
+            continue;
+        if(n == size)
+            owners=Realloc(owners, (size*=2)*sizeof(Flashcard *));
+        owners[n++]=p;
+        raw+=strlen(p->comment)+strlen(p->question)+strlen(p->answer)+3;
+        if(raw >= PACK_BLOCK)
+            pack_texts(owners, n), n=0, raw=0;
+    }
+    if(n)
+        pack_texts(owners, n);
+    Free(owners);
+}
+
+/* 統計各記錄的文字中的行，按重複出現所能省下的字節數挑選行放在預設字典
+ * 的末尾，越有價值的行越靠後，因爲deflate引用越近的內容所需的位數越少；
+ * 其余空間放入均勻抽取的記錄原文，使字典也能匹配行內反復出現的片段 */
+void train_dictionary(const Flashcard *list)
+{
+    size_t n=0, size=1024, m=0, len=0, total=0, step=0, k=0, nsample=0;
+    Dict_line *lines=Malloc(size*sizeof(Dict_line));
+
+    for(const Flashcard *p=list->next; p; p=p->next)
+    {
+        const char *texts[]={ p->comment, p->question, p->answer };
+        if(p->owner)
+            continue;
+        total+=strlen(p->comment)+strlen(p->question)+strlen(p->answer);
+        for(int i=0; i<3; i++)
+            for(const char *s=texts[i], *end=NULL; *s && n<DICT_SAMPLE; s=end)
+            {
+                end=strchr(s, '\n');
+                end = end ? end+1 : s+strlen(s);
+                if(end-s < 4) // 太短的行不值得放入字典
+                    continue;
+                if(n == size)
+                    lines=Realloc(lines, (size*=2)*sizeof(Dict_line));
+                lines[n].s=s, lines[n].len=end-s, lines[n++].count=1;
+            }
+    }
+
+    qsort(lines, n, sizeof(Dict_line), cmp_dict_text);
+    for(size_t i=0; i<n; i++) // 合併相同的行
+        if(m>0 && cmp_dict_text(lines+m-1, lines+i)==0)
+            lines[m-1].count++;
+        else
+            lines[m++]=lines[i];
+    qsort(lines, m, sizeof(Dict_line), cmp_dict_value);
+    for(size_t i=0; i<m && lines[i].count>1; i++)
+        if(len+lines[i].len <= DICT_SIZE)
+        {
+            len+=lines[i].len;
+            memcpy(packer.dict+DICT_SIZE-len, lines[i].s, lines[i].len);
+        }
+    Free(lines);
+
+    step=total/(DICT_SIZE-len+1)+1; // 使抽取的原文大致填滿其余空間
+    for(const Flashcard *p=list->next; p && nsample<DICT_SIZE-len; p=p->next)
+    {
+        const char *texts[]={ p->comment, p->question, p->answer };
+        if(p->owner || k++%step)
+            continue;
+        for(int i=0; i<3 && nsample<DICT_SIZE-len; i++)
+        {
+            size_t l=strlen(texts[i]);
+            if(l > DICT_SIZE-len-nsample)
+                l=DICT_SIZE-len-nsample;
+            memcpy(packer.dict+nsample, texts[i], l), nsample+=l;
+        }
+    }
+    memmove(packer.dict+nsample, packer.dict+DICT_SIZE-len, len);
+    packer.dict_len=nsample+len;
+}
+
+int cmp_dict_text(const void *p1, const void *p2)
+{
+    const Dict_line *l1=p1, *l2=p2;
+
+    if(l1->len != l2->len)
+        return l1->len<l2->len ? -1 : 1;
+    return memcmp(l1->s, l2->s, l1->len);
+}
+
+/* 按重複出現所能省下的字節數從大到小排序 */
+int cmp_dict_value(const void *p1, const void *p2)
+{
+    const Dict_line *l1=p1, *l2=p2;
+    size_t v1=(l1->count-1)*l1->len, v2=(l2->count-1)*l2->len;
+
+    return v1>v2 ? -1 : v1<v2;
+}
+
+/* 把各記錄的注釋、問題和答案連同各自的結束符拼在一起壓縮成一塊，然後釋放
+ * 原文 */
+void pack_texts(Flashcard **owners, size_t n)
+{
+    z_stream *z=&packer.deflater;
+    Text_block *block=Malloc(sizeof(Text_block));
+    size_t raw=0, bound;
+    char *buf=NULL;
+
+    for(size_t i=0; i<n; i++)
+        raw+=strlen(owners[i]->comment)+strlen(owners[i]->question)
+            +strlen(owners[i]->answer)+3;
+    buf=get_packer_buf(raw);
+    packer.unpacked=NULL;
+    raw=0;
+    for(size_t i=0; i<n; i++)
+    {
+        const char *texts[]={ owners[i]->comment, owners[i]->question, owners[i]->answer };
+        owners[i]->block=block, owners[i]->block_pos=raw;
+        for(int j=0; j<3; j++)
+        {
+            size_t len=strlen(texts[j])+1;
+            memcpy(buf+raw, texts[j], len), raw+=len;
+        }
+        release_text(owners[i]);
+    }
+
+    deflateReset(z);
+    if(packer.dict_len)
+        deflateSetDictionary(z, packer.dict, packer.dict_len);
+    bound=deflateBound(z, raw);
+    block->data=Malloc(bound);
+    z->next_in=(Bytef *)buf, z->avail_in=raw;
+    z->next_out=block->data, z->avail_out=bound;
+    if(deflate(z, Z_FINISH) != Z_STREAM_END)
+        die(_("壓縮抽認卡的文字失敗\n"));
+    block->len=bound-z->avail_out;
+    block->data=Realloc(block->data, block->len);
+    block->raw_len=raw;
+    block->nref=n;
+    packer.raw_total+=raw, packer.packed_total+=block->len;
+}
+
+/* 解壓抽認卡的文字所在的塊，剛解壓過的塊仍留在共用緩衝中，不必重複解壓 */
+void unpack_text(Flashcard *owner)
+{
+    const Text_block *block=owner->block;
+    z_stream *z=&packer.inflater;
+    char *buf=NULL;
+
+    if(packer.unpacked != block)
+    {
+        buf=get_packer_buf(block->raw_len);
+        inflateReset(z);
+        if(packer.dict_len)
+            inflateSetDictionary(z, packer.dict, packer.dict_len);
+        z->next_in=block->data, z->avail_in=block->len;
+        z->next_out=(Bytef *)buf, z->avail_out=block->raw_len;
+        if(inflate(z, Z_FINISH)!=Z_STREAM_END || z->avail_out)
+            die(_("解壓抽認卡的文字失敗\n"));
+        packer.unpacked=block;
+    }
+
+    buf=packer.buf+owner->block_pos;
+    owner->comment=cat_string(NULL, buf);
+    buf+=strlen(buf)+1;
+    owner->question=cat_string(NULL, buf);
+    buf+=strlen(buf)+1;
+    owner->answer=cat_string(NULL, buf);
+    link_text(owner);
+}
+
+void release_block(Text_block *block)
+{
+    if(--block->nref > 0)
+        return;
+    if(packer.unpacked == block)
+        packer.unpacked=NULL;
+    packer.raw_total-=block->raw_len, packer.packed_total-=block->len;
+    Free(block->data);
+    Free(block);
+}
+
+/* 返回至少有size字節的共用緩衝，內容不予保留 */
+char *get_packer_buf(size_t size)
+{
+    if(size > packer.buf_size)
+    {
+        Free(packer.buf);
+        packer.buf=Malloc(packer.buf_size=size);
+    }
+    return packer.buf;
+}
+
+void free_packer(void)
+{
+    if(packer.ready)
+    {
+        deflateEnd(&packer.deflater);
+        inflateEnd(&packer.inflater);
+        packer.ready=false;
+    }
+    Free(packer.buf);
+    packer.buf_size=0;
+}
+#endif
+
+/* 數據文件被外部修改時，重新載入之 */
+bool reload_if_changed(Flashcard *list)
+{
+#if HAVE_PTHREAD
+    if(loader.running) // 載入完畢後再處理
+        return false;
+#endif
+    if(!is_data_file_changed())
+        return false;
+    reload_flashcard(list, data_file);
+    puts(_("數據文件已被修改，已重新載入。"));
+    return true;
+}
+
+/* 只解析有改動的記錄：原文未變的記錄保持原樣；有改動或已刪除的記錄從鏈表中
+ * 刪除，新解析出的抽認卡若在本次運行中已復習過，則沿用其統計信息 */
+void reload_flashcard(Flashcard *list, const char *filename)
+{
+    Index records, ids;
+    Flashcard *added=create_flashcard();
+    size_t n=0;
+
+    merge_unsorted(list, true);
+    for(Flashcard *p=list->next; p; p=p->next)
+        n++;
+    init_index(&records, n);
+    for(Flashcard *p=list->next; p; p=p->next)
+        if(p->owner == NULL)
+            insert_index(&records, p->rec_hash, p);
+
+    added->deck=list->deck;
+    free_volumes(); // 清單也可能改了
+    if(!read_manifest(filename))
+        read_data_file(list, filename, 0, &records, added);
+    for(int i=0; i<nvolume; i++)
+    {
+        read_data_file(list, volumes[i].filename, i, &records, added);
+        volumes[i].comment=list->comment, list->comment=NULL;
+        Free(volumes[i].trailer);
+        volumes[i].trailer=list->answer, list->answer=NULL;
+        stat(volumes[i].filename, &volumes[i].st);
+    }
+    if(list->comment == NULL)
+        list->comment=cat_string(NULL, "");
+
+    for(Flashcard *p=added->next; p; p=p->next)
+        n++;
+    init_index(&ids, n);
+    for(Flashcard *p=list->next; p; p=p->next) // 保留下來的抽認卡
+    {
+        Flashcard *rec = p->owner ? p->owner : p;
+        if(find_index(&records, rec->rec_hash, rec)->taken)
+            insert_index(&ids, p->id, p);
+    }
+    unique_ids(added->next, &ids);
+    free_index(&ids);
+
+    init_index(&ids, n);
+    for(size_t i=0; i<records.size; i++)
+        if(records.entries[i].fc && !records.entries[i].taken)
+            for(Flashcard *p=records.entries[i].fc; p; p=p->variant)
+                if(p->dirty)
+                    insert_index(&ids, p->id, p);
+    for(Flashcard *p=added->next, *old=NULL; p; p=p->next)
+    {
+        if((old=take_index(&ids, p->id)) == NULL)
+            continue;
+        count_flashcard(p, -1);
+        p->nquiz=old->nquiz, p->n_contin_right=old->n_contin_right;
+        p->right_rate=old->right_rate, p->latency=old->latency;
+        p->prev_time=old->prev_time, p->dirty=true;
+        count_flashcard(p, 1);
+    }
+    free_index(&ids);
+
+    remove_records(list, &records);
+    free_index(&records);
+    sort_flashcard(added);
+    merge_sorted(list, added);
+    free_flashcard(added);
+    stat(filename, &data_stat);
+    watch_data_file(); // 可能有新的卷
+}
+
+/* 刪除records中未被取走的記錄及其派生抽認卡 */
+void remove_records(Flashcard *list, Index *records)
+{
+    Flashcard *trash=NULL;
+
+    for(Flashcard *p=list->next, *prev=list, *owner=NULL; p; p=prev->next)
+    {
+        owner = p->owner ? p->owner : p;
+        if(find_index(records, owner->rec_hash, owner)->taken)
+            { prev=p; continue; }
+        count_flashcard(p, -1);
+        prev->next=p->next, p->next=trash, trash=p;
+    }
+    for(Flashcard *next=NULL; trash; trash=next)
+        next=trash->next, free_flashcard(trash);
+}
+
+/* 復習日志的每行記錄一次復習後抽認卡的完整統計信息，故重放時只需按標識
+ * 覆蓋統計信息，多次重放的結果相同。日志在數據文件保存成功後刪除，因此啓動
+ * 時存在的日志都是上次運行異常退出時遺留的 */
+int replay_journal(Flashcard *list, const char *filename)
+{
+    FILE *fp=fopen(filename, "r");
+    char line[LINE_MAX];
+    Index ids;
+    Flashcard *fc=NULL, rec;
+    uint64_t id;
+    long long prev_time;
+    size_t n=0;
+    int nreplay=0;
+
+    if(fp == NULL)
+        return 0;
+    for(Flashcard *p=list->next; p; p=p->next)
+        n++;
+    init_index(&ids, n);
+    for(Flashcard *p=list->next; p; p=p->next)
+        insert_index(&ids, p->id, p);
+
+    while(fgets(line, LINE_MAX, fp))
+    {
+        if(strchr(line, '\n') == NULL) // 寫到一半時被中斷的記錄
+            break;
+        prev_time=0; // 舊日志沒有上次復習時間
+        if(sscanf(line, "%" SCNx64 " %d %d %lf %lf %lld", &id, &rec.nquiz,
+            &rec.n_contin_right, &rec.right_rate, &rec.latency, &prev_time) < 5
+            || (fc=search_index(&ids, id)) == NULL)
+            continue;
+        count_flashcard(fc, -1);
+        fc->nquiz=rec.nquiz, fc->n_contin_right=rec.n_contin_right;
+        fc->right_rate=rec.right_rate, fc->latency=rec.latency;
+        if(prev_time > 0)
+            fc->prev_time=prev_time;
+        fc->dirty=true;
+        count_flashcard(fc, 1);
+        nreplay++;
+    }
+    free_index(&ids);
+    fclose(fp);
+
+    return nreplay;
+}
+
+void open_journal(void)
+{
+    if((journal=fopen(journal_file, "a")) == NULL)
+        fprintf(stderr, _("不能打開復習日志，本次復習在異常退出時將會丟失：%s\n"),
+            journal_file);
+}
+
+void append_journal(const Flashcard *fc)
+{
+    static int npending=0;
+
+    if(journal == NULL)
+        return;
+    fprintf(journal, "%016" PRIx64 " %d %d %.17g %.17g %lld\n", fc->id, fc->nquiz,
+        fc->n_contin_right, fc->right_rate, fc->latency, (long long)fc->prev_time);
+    if(++npending == JOURNAL_BATCH)
+        sync_journal(), npending=0;
+    else
+        fflush(journal);
+}
+
+void sync_journal(void)
+{
+    if(journal && fflush(journal)==0)
+        fsync(fileno(journal));
+}
+
+/* 數據文件已保存，日志中的復習都已生效 */
+void commit_journal(void)
+{
+    if(journal)
+        fclose(journal), journal=NULL;
+    if(journal_file)
+        remove(journal_file);
+}
+
+/* 以inotify監視數據文件及其各卷，不支持時則每次都比較文件狀態 */
+void watch_data_file(void)
+{
+#if HAVE_INOTIFY
+    if(inotify_fd == -1)
+        inotify_fd=inotify_init1(IN_NONBLOCK);
+    for(int i=-1; inotify_fd!=-1 && i<nvolume; i++)
+        inotify_add_watch(inotify_fd, i<0 ? data_file : volumes[i].filename,
+            IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF | IN_ATTRIB);
+#endif
+}
+
+bool is_data_file_changed(void)
+{
+#if HAVE_INOTIFY
+    char buf[4096];
+    bool changed=data_changed;
+
+    data_changed=false;
+    if(inotify_fd != -1)
+    {
+        while(read(inotify_fd, buf, sizeof(buf)) > 0)
+            changed=true;
+        if(!changed)
+            return false;
+        watch_data_file(); // 數據文件可能已被替換
+    }
+#endif
+    if(is_file_changed(data_file, &data_stat))
+        return true;
+    for(int i=0; i<nvolume; i++)
+        if(is_file_changed(volumes[i].filename, &volumes[i].st))
+            return true;
+    return false;
+}
+
+bool is_file_changed(const char *filename, const struct stat *old)
+{
+    struct stat st;
+
+    return stat(filename, &st)==0 && (st.st_mtime!=old->st_mtime
+        || st.st_size!=old->st_size || st.st_ino!=old->st_ino);
+}
+
+/* 改名後同步文件所在的目錄，改名本身纔會落盤，斷電後不會又見到舊文件 */
+bool sync_parent_dir(const char *filename)
+{
+    const char *slash=strrchr(filename, '/');
+    char *dir = slash ? cat_string(NULL, filename) : cat_string(NULL, ".");
+    int fd;
+    bool ok;
+
+    if(slash)
+        dir[slash==filename ? 1 : slash-filename]='\0';
+    fd=open(dir, O_RDONLY);
+    ok = fd!=-1 && fsync(fd)==0;
+    if(fd != -1)
+        close(fd);
+    Free(dir);
+
+    return ok;
+}
+
+void init_index(Index *index, size_t n)
+{
+    for(index->size=16; index->size<2*n; index->size*=2)
+        ;
+    index->entries=Malloc(index->size*sizeof(Index_entry));
+    index->count=0;
+    for(size_t i=0; i<index->size; i++)
+        index->entries[i].fc=NULL, index->entries[i].taken=false;
+}
+
+/* 保證還能再插入n個表項，不夠時擴大散列表並重新插入已有的表項 */
+void reserve_index(Index *index, size_t n)
+{
+    Index old=*index;
+
+    if(2*(index->count+n) <= index->size)
+        return;
+    init_index(index, old.count+n);
+    for(size_t i=0; i<old.size; i++)
+        if(old.entries[i].fc)
+        {
+            insert_index(index, old.entries[i].key, old.entries[i].fc);
+            find_index(index, old.entries[i].key, old.entries[i].fc)->taken=old.entries[i].taken;
+        }
+    free_index(&old);
+}
+
+void free_index(Index *index)
+{
+    Free(index->entries);
+    index->size=0;
+}
+
+/* 調用者須保證插入的表項數不超過init_index時所給出的數目 */
+void insert_index(Index *index, uint64_t key, Flashcard *fc)
+{
+    size_t i=key&(index->size-1);
+
+    while(index->entries[i].fc)
+        i=(i+1)&(index->size-1);
+    index->entries[i].key=key, index->entries[i].fc=fc;
+    index->count++;
+}
+
+/* 查找鍵爲key、值爲fc的表項 */
+Index_entry *find_index(Index *index, uint64_t key, const Flashcard *fc)
+{
+    for(size_t i=key&(index->size-1); index->entries[i].fc; i=(i+1)&(index->size-1))
+        if(index->entries[i].key==key && index->entries[i].fc==fc)
+            return index->entries+i;
+    return NULL;
+}
+
+/* 取走一個鍵爲key且未被取走的表項，返回其值，沒有時返回NULL */
+Flashcard *take_index(Index *index, uint64_t key)
+{
+    for(size_t i=key&(index->size-1); index->entries[i].fc; i=(i+1)&(index->size-1))
+        if(index->entries[i].key==key && !index->entries[i].taken)
+        {
+            index->entries[i].taken=true;
+            return index->entries[i].fc;
+        }
+    return NULL;
+}
+
+/* 查找一個鍵爲key的表項，返回其值，沒有時返回NULL */
+Flashcard *search_index(const Index *index, uint64_t key)
+{
+    for(size_t i=key&(index->size-1); index->entries[i].fc; i=(i+1)&(index->size-1))
+        if(index->entries[i].key == key)
+            return index->entries[i].fc;
+    return NULL;
+}
+
+FILE *Fopen(const char *filename, const char *mode)
+{
+    FILE *fp=fopen(filename, mode);
+    if(fp == NULL)
+        die(_("打開文件失敗：%s\n"), filename);
+    return fp;
+}
+
+Flashcard *create_flashcard(void)
+{
+    Flashcard *fc=Malloc(sizeof(Flashcard));
+    fc->comment=fc->question=fc->answer=NULL;
+    fc->nquiz=fc->n_contin_right=0;
+    fc->right_rate=0.0;
+    fc->latency=0.0;
+    fc->prev_time=fc->next_time=0;
+    fc->deck=NULL;
+    fc->id=0;
+    fc->owner=fc->variant=NULL;
+    fc->cloze=0;
+    fc->reverse=false;
+    fc->dirty=false;
+    fc->checksum=false;
+    fc->archived=false;
+    fc->volume=0;
+    fc->rec_hash=0;
+    fc->offset=0;
+    fc->length=0;
+    fc->cached=NULL;
+    fc->block=NULL;
+    fc->block_pos=0;
+    fc->next=NULL;
+
+    return fc;
+}
+
+void free_flashcards(Flashcard *list)
+{
+    for(Flashcard *p=list->next, *next=NULL; p; p=next)
+    {
+        next=p->next;
+        del_flashcard(p, list);
+        free_flashcard(p);
+    }
+    free_decks(list->deck);
+    free_flashcard(list);
+}
+
+void free_flashcard(Flashcard *node)
+{
+    if(node->owner == NULL)
+    {
+        uncache_text(node);
+        Free(node->comment);
+        Free(node->question);
+        Free(node->answer);
+#if HAVE_ZLIB
+        if(node->block)
+            release_block(node->block);
+#endif
+    }
+    Free(node);
+}
+
+void add_flashcard(Flashcard *node, Flashcard *list, time_t cur_time)
+{
+    Flashcard *p=NULL, *prev=NULL;
+    bool cmp_time = (cur_time > node->next_time);
+
+    for(p=list->next, prev=list; p; prev=p, p=p->next)
+        if(is_front_flashcard(node, p, cmp_time))
+            break;
+
+    prev->next=node, node->next=p;
+}
+
+void del_flashcard(Flashcard *node, Flashcard *list)
+{
+    for(Flashcard *p=list->next, *prev=list; p; prev=p, p=p->next)
+        if(p == node)
+            { prev->next=p->next; return; }
+}
+
+/* 按排序鍵穩定地排序。抽認卡多於SORT_RUN個時先試以臨時文件作外部歸併排序；
+ * 建不成或寫不進臨時文件時，每SORT_RUN個一輪，以排序鍵數組排好序後鏈成有序
+ * 的子鏈表，各輪再按原次序兩兩歸併 */
+void sort_flashcard(Flashcard *list)
+{
+    time_t cur_time=time(NULL);
+    Flashcard *p=list->next, **runs=NULL;
+    Sort_key *keys=NULL;
+    size_t total=0, n=0, nrun=0;
+
+    for(const Flashcard *q=list->next; q; q=q->next)
+        total++;
+    if(total == 0)
+        return;
+    keys=Malloc((total<SORT_RUN ? total : SORT_RUN)*sizeof(Sort_key));
+    if(total>SORT_RUN && spill_sort(list, keys, total, cur_time))
+        { Free(keys); return; }
+    runs=Malloc((total+SORT_RUN-1)/SORT_RUN*sizeof(Flashcard *));
+    while(p)
+    {
+        for(n=0; p && n<SORT_RUN; p=p->next, n++)
+            make_sort_key(keys+n, p, n, cur_time);
+        if(!radix_sort_keys(keys, n))
+            qsort(keys, n, sizeof(Sort_key), cmp_sort_key);
+        for(size_t i=0; i<n; i++)
+            keys[i].fc->next = i+1<n ? keys[i+1].fc : NULL;
+        runs[nrun++]=keys[0].fc;
+    }
+    Free(keys);
+
+    for(size_t width=1; width<nrun; width*=2)
+        for(size_t i=0; i+width<nrun; i+=2*width)
+            runs[i]=merge_runs(runs[i], runs[i+width], cur_time);
+    list->next=runs[0];
+    Free(runs);
+}
+
+void make_sort_key(Sort_key *key, Flashcard *fc, size_t seq, time_t cur_time)
+{
+    key->fc=fc, key->seq=seq;
+    key->next_time=0;
+    if(is_long_term_memory(fc))
+        key->rank=2;
+    else if(cur_time > fc->next_time)
+        key->rank=0, key->next_time=fc->next_time;
+    else
+        key->rank=1;
+    key->n_contin_right=fc->n_contin_right;
+    key->right_rate=fc->right_rate;
+}
+
+int cmp_sort_key(const void *p1, const void *p2)
+{
+    const Sort_key *k1=p1, *k2=p2;
+
+    if(k1->rank != k2->rank)
+        return k1->rank<k2->rank ? -1 : 1;
+    if(k1->next_time != k2->next_time)
+        return k1->next_time<k2->next_time ? -1 : 1;
+    if(k1->rank!=2 && k1->n_contin_right!=k2->n_contin_right)
+        return k1->n_contin_right<k2->n_contin_right ? -1 : 1;
+    if(k1->rank!=2 && k1->right_rate!=k2->right_rate)
+        return k1->right_rate<k2->right_rate ? -1 : 1;
+    return k1->seq<k2->seq ? -1 : k1->seq>k2->seq;
+}
+
+/* 以LSD基數排序代替qsort，次序與按cmp_sort_key排序的相同。排序鍵壓成兩個無
+ * 符號64位整數：高位鍵依次是rank、已到復習時間者的下次復習時間和連續答對次數，
+ * 時間和次數都減去最小值後再壓入；低位鍵是正確率。先按低位鍵、再按高位鍵各排
+ * 一遍，計數排序是穩定的，其餘字段相同時保持seq的次序。高位鍵放不下時返回
+ * false，由調用者改用qsort */
+bool radix_sort_keys(Sort_key *keys, size_t n)
+{
+    long long tmin=LLONG_MAX, tmax=LLONG_MIN;
+    long long cmin=LLONG_MAX, cmax=LLONG_MIN;
+    int tbits=0, cbits=0;
+    Radix_pair *buf=NULL, *a=NULL, *b=NULL;
+    Sort_key *sorted=NULL;
+
+    for(size_t i=0; i<n; i++)
+    {
+        if(keys[i].rank == 0)
+        {
+            tmin = keys[i].next_time<tmin ? keys[i].next_time : tmin;
+            tmax = keys[i].next_time>tmax ? keys[i].next_time : tmax;
+        }
+        if(keys[i].rank != 2)
+        {
+            cmin = keys[i].n_contin_right<cmin ? keys[i].n_contin_right : cmin;
+            cmax = keys[i].n_contin_right>cmax ? keys[i].n_contin_right : cmax;
+        }
+    }
+    if(tmin <= tmax)
+        tbits=bit_width((uint64_t)tmax-(uint64_t)tmin);
+    if(cmin <= cmax)
+        cbits=bit_width((uint64_t)(cmax-cmin));
+    if(n < 2)
+        return true;
+    if(tbits+cbits > 62)
+        return false;
+
+    buf=Malloc(2*n*sizeof(Radix_pair));
+    for(size_t i=0; i<n; i++)
+        buf[i].key=pack_rate(keys+i), buf[i].index=i;
+    a=radix_sort(buf, buf+n, n);
+    b = a==buf ? buf+n : buf;
+    for(size_t i=0; i<n; i++)
+    {
+        const Sort_key *k=keys+a[i].index;
+        a[i].key=(uint64_t)k->rank << 62;
+        if(k->rank == 0)
+            a[i].key |= ((uint64_t)k->next_time-(uint64_t)tmin) << cbits;
+        if(k->rank != 2)
+            a[i].key |= (uint64_t)(k->n_contin_right-cmin);
+    }
+    a=radix_sort(a, b, n);
+
+    sorted=Malloc(n*sizeof(Sort_key));
+    for(size_t i=0; i<n; i++)
+        sorted[i]=keys[a[i].index];
+    memcpy(keys, sorted, n*sizeof(Sort_key));
+    Free(sorted);
+    Free(buf);
+
+    return true;
+}
+
+/* 把正確率按位映射成無符號整數，大小次序不變。已形成長時記憶的抽認卡不比較
+ * 正確率，一律爲0 */
+uint64_t pack_rate(const Sort_key *key)
+{
+    double rate = key->right_rate==0 ? 0 : key->right_rate; // -0與0相等
+    uint64_t n;
+
+    if(key->rank == 2)
+        return 0;
+    memcpy(&n, &rate, sizeof(n));
+    return n>>63 ? ~n : n|1ULL<<63;
+}
+
+/* 按key對a中的n個元素做LSD基數排序，每趟按一個字節計數排序，各元素該字節都
+ * 相同的一趟跳過。b是同樣大小的緩衝，返回排好序的結果所在的數組 */
+Radix_pair *radix_sort(Radix_pair *a, Radix_pair *b, size_t n)
+{
+    size_t count[8][256]={{0}};
+
+    for(size_t i=0; i<n; i++)
+        for(int d=0; d<8; d++)
+            count[d][a[i].key>>8*d & 0xff]++;
+    for(int d=0; d<8; d++)
+    {
+        Radix_pair *t=a;
+        if(count[d][a[0].key>>8*d & 0xff] == n)
+            continue;
+        for(size_t i=0, sum=0, c; i<256; i++)
+            c=count[d][i], count[d][i]=sum, sum+=c;
+        for(size_t i=0; i<n; i++)
+            b[count[d][a[i].key>>8*d & 0xff]++]=a[i];
+        a=b, b=t;
+    }
+
+    return a;
+}
+
+/* 表示n所需的二進制位數 */
+int bit_width(uint64_t n)
+{
+    int bits=0;
+    for(; n; n>>=1)
+        bits++;
+    return bits;
+}
+
+/* 歸併兩個已排好序的抽認卡鏈表。排序鍵相同時a中的在前，a在原鏈表中的位置
+ * 在b之前，排序因此仍是穩定的 */
+Flashcard *merge_runs(Flashcard *a, Flashcard *b, time_t cur_time)
+{
+    Flashcard *head=NULL, **tail=&head;
+    Sort_key ka, kb;
+
+    if(a && b)
+        make_sort_key(&ka, a, 0, cur_time), make_sort_key(&kb, b, 0, cur_time);
+    while(a && b)
+        if(cmp_sort_key(&kb, &ka) < 0)
+        {
+            *tail=b, tail=&b->next, b=b->next;
+            if(b)
+                make_sort_key(&kb, b, 0, cur_time);
+        }
+        else
+        {
+            *tail=a, tail=&a->next, a=a->next;
+            if(a)
+                make_sort_key(&ka, a, 0, cur_time);
+        }
+    *tail = a ? a : b;
+
+    return head;
+}
+
+/* 每SORT_RUN個抽認卡排成一輪寫入臨時文件，再多路歸併。寫完各輪前不改動
+ * 鏈表，臨時文件建不成或寫不進時返回false，鏈表原樣不變 */
+bool spill_sort(Flashcard *list, Sort_key *keys, size_t total, time_t cur_time)
+{
+    FILE *fp=tmpfile();
+    size_t n=0, nrun=0;
+
+    if(fp == NULL)
+        return false;
+    for(Flashcard *p=list->next; p; nrun++)
+    {
+        for(n=0; p && n<SORT_RUN; p=p->next, n++)
+            make_sort_key(keys+n, p, nrun*SORT_RUN+n, cur_time);
+        if(!radix_sort_keys(keys, n))
+            qsort(keys, n, sizeof(Sort_key), cmp_sort_key);
+        if(fwrite(keys, sizeof(Sort_key), n, fp) != n)
+            { fclose(fp); return false; }
+    }
+    if(fflush(fp))
+        { fclose(fp); return false; }
+    merge_spilled_runs(list, fp, nrun, total);
+    fclose(fp);
+
+    return true;
+}
+
+/* 以二叉堆從臨時文件中的各輪排序鍵裏依次取出最小者，按此次序重新鏈接抽認卡。
+ * 排序鍵中的序號是全局的，各輪之間也保持穩定。所用內存只與輪數有關 */
+void merge_spilled_runs(Flashcard *list, FILE *fp, size_t nrun, size_t total)
+{
+    Sort_run *runs=Malloc(nrun*sizeof(Sort_run));
+    size_t *heap=Malloc(nrun*sizeof(size_t)), nheap=0;
+    Flashcard *tail=list;
+    int fd=fileno(fp);
+
+    for(size_t i=0; i<nrun; i++)
+    {
+        runs[i].offset=(off_t)(i*SORT_RUN*sizeof(Sort_key));
+        runs[i].remain = i<nrun-1 ? SORT_RUN : total-i*SORT_RUN;
+        if(fill_run(runs+i, fd))
+            heap[nheap++]=i;
+    }
+    for(size_t i=nheap/2; i-- > 0; )
+        sift_runs(runs, heap, nheap, i);
+
+    while(nheap)
+    {
+        Sort_run *run=runs+heap[0];
+        tail=tail->next=run->buf[run->pos++].fc;
+        if(run->pos==run->n && !fill_run(run, fd))
+            heap[0]=heap[--nheap];
+        sift_runs(runs, heap, nheap, 0);
+    }
+    tail->next=NULL;
+    Free(heap);
+    Free(runs);
+}
+
+/* 把一輪中的下一批排序鍵讀入緩衝，該輪已讀完時返回false。此時鏈表已開始
+ * 重新鏈接，讀不回來只能退出 */
+bool fill_run(Sort_run *run, int fd)
+{
+    size_t n = run->remain<SORT_BUFFER ? run->remain : SORT_BUFFER;
+
+    if(n == 0)
+        return false;
+    if(pread(fd, run->buf, n*sizeof(Sort_key), run->offset) != (ssize_t)(n*sizeof(Sort_key)))
+        die(_("讀取臨時文件失敗\n"));
+    run->offset+=n*sizeof(Sort_key);
+    run->remain-=n, run->n=n, run->pos=0;
+
+    return true;
+}
+
+/* 把堆中第i個元素下沉到合適的位置，堆頂爲當前排序鍵最小的一輪 */
+void sift_runs(const Sort_run *runs, size_t *heap, size_t n, size_t i)
+{
+    for(size_t child; (child=2*i+1) < n; i=child)
+    {
+        const Sort_run *a=NULL, *b=NULL;
+        if(child+1 < n)
+        {
+            a=runs+heap[child+1], b=runs+heap[child];
+            if(cmp_sort_key(a->buf+a->pos, b->buf+b->pos) < 0)
+                child++;
+        }
+        a=runs+heap[child], b=runs+heap[i];
+        if(cmp_sort_key(a->buf+a->pos, b->buf+b->pos) >= 0)
+            break;
+        size_t t=heap[i];
+        heap[i]=heap[child], heap[child]=t;
+    }
+}
+
+/* 對各數據文件中的全部抽認卡分別以qsort和基數排序排列排序鍵，各取BENCH_ROUNDS
+ * 次中最快的用時，並核對兩者的次序是否相同。次序不同時返回EXIT_FAILURE */
+int bench_sort(int n, char **filenames)
+{
+    time_t cur_time=time(NULL);
+    int status=EXIT_SUCCESS;
+
+    for(int i=0; i<n; i++)
+    {
+        Flashcard *list=create_flashcard();
+        Sort_key *keys=NULL, *k1=NULL, *k2=NULL;
+        double t1=HUGE_VAL, t2=HUGE_VAL, start, elapsed;
+        size_t total=0, seq=0;
+        bool same=true, radix=true;
+
+        list->deck=create_deck("", NULL);
+        read_data_file(list, filenames[i], 0, NULL, list);
+        for(const Flashcard *p=list->next; p; p=p->next)
+            total++;
+        keys=Malloc(3*(total ? total : 1)*sizeof(Sort_key));
+        k1=keys+total, k2=k1+total;
+        for(Flashcard *p=list->next; p; p=p->next)
+            make_sort_key(keys+seq, p, seq, cur_time), seq++;
+        for(int r=0; r<BENCH_ROUNDS; r++)
+        {
+            memcpy(k1, keys, total*sizeof(Sort_key));
+            start=get_seconds();
+            qsort(k1, total, sizeof(Sort_key), cmp_sort_key);
+            if((elapsed=get_seconds()-start) < t1)
+                t1=elapsed;
+            memcpy(k2, keys, total*sizeof(Sort_key));
+            start=get_seconds();
+            radix=radix_sort_keys(k2, total);
+            if((elapsed=get_seconds()-start) < t2)
+                t2=elapsed;
+        }
+        for(size_t j=0; j<total; j++)
+            same = same && k1[j].fc==k2[j].fc;
+        printf(_("%s：%zu個抽認卡，qsort用時%.3f秒，基數排序用時%.3f秒，次序%s\n"),
+            filenames[i], total, t1, t2, !radix ? _("無法壓縮排序鍵") : same ? _("相同") : _("不同"));
+        if(!radix || !same)
+            status=EXIT_FAILURE;
+        Free(keys);
+        free_flashcards(list);
+    }
+
+    return status;
+}
+
+bool has_flashcard(const Flashcard *list)
+{
+    return list && list->next;
+}
+
+bool is_front_flashcard(const Flashcard *fc1, const Flashcard *fc2, bool cmp_time)
+{
+    if(is_long_term_memory(fc1))
+        return false;
+    else if(cmp_time && (fc1->next_time < fc2->next_time))
+        return true;
+    else if(cmp_time && (fc1->next_time > fc2->next_time))
+        return false;
+    else if(fc1->n_contin_right < fc2->n_contin_right)
+        return true;
+    else if(fc1->n_contin_right > fc2->n_contin_right)
+        return false;
+    else if(fc1->right_rate < fc2->right_rate)
+        return true;
+    else
+        return false;
+}
+
+bool is_long_term_memory(const Flashcard *fc)
+{
+    return (fc->n_contin_right >= N_LONG_TERM_MEMORY);
+}
+
+char *cat_string(char *dst, const char *src)
+{
+    if(dst)
+        dst=realloc(dst, strlen(dst)+strlen(src)+1);
+    else
+        dst=Malloc(strlen(src)+1), dst[0]='\0';
+    return strcat(dst, src);
+}
+
+/* 上次復習時間照錄，限時復習據此估計遺忘的概率；沒有時則以載入時間代之 */
+void load_info(Flashcard *fc, const char *input)
+{
+    long long prev_time=0;
+
+    sscanf(input, "%d %d %lf %lld %*s %lf", &fc->nquiz, &fc->n_contin_right,
+        &fc->right_rate, &prev_time, &fc->latency);
+    fc->prev_time = prev_time>0 ? (time_t)prev_time : time(NULL);
+}
+
+void load_deck(Flashcard *fc, Deck *root, const char *input)
+{
+    Deck *deck=get_deck(root, input);
+    if(deck != root) // 忽略空白行
+        fc->deck=deck;
+}
+
+/* 下次復習時間從載入時算起，不受讀入的上次復習時間影響 */
+void fix_flashcard(Flashcard *fc)
+{
+    time_t now=time(NULL);
+
+    fix_text(fc);
+    if(fc->prev_time == 0)
+        fc->prev_time=now;
+
+    struct tm *p=gmtime(&now);
+    if(p->tm_mon < 11)
+        p->tm_mon++;
+    else
+        p->tm_mon=0, p->tm_year++;
+    fc->next_time=mktime(p);
+}
+
+void fix_text(Flashcard *fc)
+{
+    if(fc->comment == NULL)
+        fc->comment=cat_string(NULL, "");
+    if(fc->question == NULL)
+        fc->question=cat_string(NULL, "\n");
+    if(fc->answer == NULL)
+        fc->answer=cat_string(NULL, "\n");
+}
+
+/* 把讀入的抽認卡記錄及其派生抽認卡接在鏈表的tail之後，並計入所屬卡組，
+ * 返回新的表尾。鏈表由調用者在讀完後一次排好序 */
+Flashcard *install_flashcard(Flashcard *fc, const Flashcard *list, Flashcard *tail)
+{
+    fix_text(fc);
+    fix_cloze_flashcards(fc); // 可能換掉記錄本身的統計信息，之後才算下次復習時間
+    fix_flashcard(fc);
+    if(fc->deck == NULL)
+        fc->deck=list->deck;
+    link_text(fc);
+    for(Flashcard *p=fc; p; p=p->variant)
+    {
+        if(p->owner)
+            p->deck=fc->deck, fix_flashcard(p);
+        p->id=hash_flashcard(p);
+        tail=tail->next=p;
+        count_flashcard(p, 1);
+    }
+    tail->next=NULL;
+
+    return tail;
+}
+
+/* 反向抽認卡以原抽認卡的答案爲問題、問題爲答案，文字在install_flashcard
+ * 時才指向原抽認卡的文字，不另行複製 */
+Flashcard *create_reverse_flashcard(Flashcard *owner)
+{
+    Flashcard *fc=create_flashcard();
+    fc->owner=owner, fc->reverse=true;
+    return fc;
+}
+
+/* 返回記錄中第n個填空抽認卡（第0個即爲記錄本身），不存在時則創建之。
+ * 此時尚不知道填空序號，由fix_cloze_flashcards確定 */
+Flashcard *get_cloze_flashcard(Flashcard *owner, int n)
+{
+    Flashcard *fc=owner, *p=NULL;
+
+    for(p=owner->variant; n>0 && p; p=p->variant)
+        if(!p->reverse)
+            fc=p, n--;
+    for(; n>0; n--)
+    {
+        fc=create_flashcard(), fc->owner=owner;
+        append_variant(owner, fc);
+    }
+
+    return fc;
+}
+
+void append_variant(Flashcard *owner, Flashcard *fc)
+{
+    Flashcard *p=owner;
+    while(p->variant)
+        p=p->variant;
+    p->variant=fc;
+}
+
+/* 按問題中填空序號的升序，把各個序號分配給記錄本身及其填空抽認卡，統計信息
+ * 按序號對應：帶序號的統計信息歸同一序號的抽認卡，改了序號的次序也不會錯位；
+ * 舊格式的統計信息不帶序號，按次序對應。問題中已沒有的序號的抽認卡刪除，
+ * 新增的序號則新建抽認卡。只記錄序號，不生成遮蔽後的文字 */
+void fix_cloze_flashcards(Flashcard *owner)
+{
+    int first=next_cloze_no(owner->question, 0);
+    Flashcard *held=create_flashcard(), *reverse=NULL, **rtail=&reverse;
+    Flashcard **tail=&held->variant, *fc=NULL;
+    bool numbered = owner->cloze!=0;
+
+    /* 各填空的統計信息連同記錄本身的先都取下，再按序號取回 */
+    copy_info(held, owner), held->cloze=owner->cloze, held->owner=owner;
+    for(Flashcard *p=owner->variant, *next=NULL; p; p=next)
+    {
+        next=p->variant, p->variant=NULL;
+        numbered = numbered || (!p->reverse && p->cloze);
+        if(p->reverse)
+            *rtail=p, rtail=&p->variant;
+        else
+            *tail=p, tail=&p->variant;
+    }
+    if(!numbered) // 舊格式，按次序對應
+    {
+        int no=first;
+        for(Flashcard *p=held; p; p=p->variant)
+        {
+            p->cloze=no;
+            if(no)
+                no=next_cloze_no(owner->question, no);
+        }
+    }
+
+    owner->variant=NULL, tail=&owner->variant;
+    for(int no=first; no; no=next_cloze_no(owner->question, no))
+    {
+        fc=take_cloze(&held, no);
+        if(no == first)
+        {
+            if(fc == NULL) // 新增的填空排在最前，記錄本身從頭統計
+                fc=create_flashcard();
+            fc->owner=owner, copy_info(owner, fc), free_flashcard(fc);
+            continue;
+        }
+        if(fc == NULL)
+            fc=create_flashcard();
+        fc->owner=owner, fc->cloze=no;
+        *tail=fc, tail=&fc->variant;
+    }
+    *tail=reverse;
+    owner->cloze=first;
+    for(Flashcard *next=NULL; held; held=next) // 刪除多出的填空抽認卡
+        next=held->variant, held->owner=owner, free_flashcard(held);
+}
+
+/* 從held鏈中取下序號爲no的填空抽認卡，沒有時返回NULL */
+Flashcard *take_cloze(Flashcard **held, int no)
+{
+    for(Flashcard *fc=NULL; (fc=*held); held=&fc->variant)
+        if(fc->cloze == no)
+        {
+            *held=fc->variant, fc->variant=NULL;
+            return fc;
+        }
+
+    return NULL;
+}
+
+void copy_info(Flashcard *dst, const Flashcard *src)
+{
+    dst->nquiz=src->nquiz, dst->n_contin_right=src->n_contin_right;
+    dst->right_rate=src->right_rate, dst->latency=src->latency;
+    dst->prev_time=src->prev_time, dst->next_time=src->next_time;
+}
+
+/* 在s中查找下一個填空標記，找不到時返回NULL */
+const char *find_cloze(const char *s, Cloze *cloze)
+{
+    for(const char *p=strstr(s, "{{c"); p; p=strstr(p+1, "{{c"))
+    {
+        const char *q=p+3, *end=NULL, *sep=NULL;
+        if(!isdigit((unsigned char)*q))
+            continue;
+        for(cloze->no=0; isdigit((unsigned char)*q) && cloze->no<INT_MAX/10; q++)
+            cloze->no=cloze->no*10+(*q-'0');
+        if(isdigit((unsigned char)*q)) // 序號過大，不作填空標記
+            continue;
+        if(cloze->no<=0 || strncmp(q, "::", 2) || !(end=strstr(q+2, "}}")))
+            continue;
+        cloze->text=q+2, cloze->hint=NULL, cloze->hint_len=0;
+        sep=strstr(cloze->text, "::");
+        if(sep && sep<end)
+        {
+            cloze->len=sep-cloze->text;
+            cloze->hint=sep+2, cloze->hint_len=end-cloze->hint;
+        }
+        else
+            cloze->len=end-cloze->text;
+        cloze->end=end+2;
+        return p;
+    }
+    return NULL;
+}
+
+/* 返回問題中大於no的最小填空序號，沒有時返回0 */
+int next_cloze_no(const char *question, int no)
+{
+    Cloze cloze;
+    int next=0;
+
+    for(const char *p=question; (p=find_cloze(p, &cloze)); p=cloze.end)
+        if(cloze.no>no && (next==0 || cloze.no<next))
+            next=cloze.no;
+
+    return next;
+}
+
+/* 在暫存區中生成遮蔽序號爲no的填空後的問題，reveal爲真時則標出被遮蔽的文字。
+ * 生成的文字不會比原文長，因此按原文長度分配內存即可 */
+char *mask_cloze(const char *question, int no, bool reveal)
+{
+    char *s=alloc_arena(&scratch, strlen(question)+1), *q=s;
+    const char *p=question, *start=NULL;
+    Cloze cloze;
+
+    while((start=find_cloze(p, &cloze)))
+    {
+        memcpy(q, p, start-p), q+=start-p;
+        if(cloze.no == no)
+            *q++='[';
+        if(cloze.no!=no || reveal)
+            memcpy(q, cloze.text, cloze.len), q+=cloze.len;
+        else if(cloze.hint)
+            memcpy(q, cloze.hint, cloze.hint_len), q+=cloze.hint_len;
+        else
+            memcpy(q, "...", 3), q+=3;
+        if(cloze.no == no)
+            *q++=']';
+        p=cloze.end;
+    }
+    strcpy(q, p);
+
+    return s;
+}
+
+const char *get_question(Flashcard *fc)
+{
+    load_text(fc);
+    return fc->cloze ? mask_cloze(fc->question, fc->cloze, false) : fc->question;
+}
+
+const char *get_answer(Flashcard *fc)
+{
+    load_text(fc);
+    if(fc->reverse && fc->owner->cloze) // 反向抽認卡的答案即原問題，去掉其中的填空標記
+        return mask_cloze(fc->answer, 0, false);
+    if(fc->cloze == 0)
+        return fc->answer;
+
+    char *question=mask_cloze(fc->question, fc->cloze, true);
+    char *s=alloc_arena(&scratch, strlen(question)+strlen(fc->answer)+1);
+    return strcat(strcpy(s, question), fc->answer);
+}
+
+/* FNV-1a散列。因問題和答案的次序參與散列，反向抽認卡的標識與原抽認卡不同；
+ * 填空抽認卡則另以填空序號區分 */
+uint64_t hash_flashcard(const Flashcard *fc)
+{
+    uint64_t h=hash_string(HASH_BASIS, fc->question);
+
+    h=(h^'\0')*1099511628211ULL;
+    h=hash_string(h, fc->answer);
+    for(int no=fc->cloze; no; no/=10)
+        h=(h^('0'+no%10))*1099511628211ULL;
+
+    return h;
+}
+
+/* 問題、答案都相同的抽認卡散列相同，按在數據文件中的次序，後出現的依次再散列，
+ * 使fc起的各抽認卡的標識與ids中的及彼此都不重複，復習日志和隊列纔不會認錯。
+ * 不重複的抽認卡的標識不變 */
+void unique_ids(Flashcard *fc, Index *ids)
+{
+    for(; fc; fc=fc->next)
+    {
+        while(search_index(ids, fc->id))
+            fc->id=(fc->id^'#')*1099511628211ULL;
+        insert_index(ids, fc->id, fc);
+    }
+}
+
+uint64_t hash_string(uint64_t h, const char *s)
+{
+    for(const unsigned char *p=(const unsigned char *)s; *p; p++)
+        h=(h^*p)*1099511628211ULL;
+    return h;
+}
+
+char *alloc_arena(Arena *arena, size_t size)
+{
+    Arena_block *b=arena->block;
+
+    if(b==NULL || b->size-b->used<size)
+    {
+        size_t n = b && b->size>size ? 2*b->size : (size>LINE_MAX ? size : LINE_MAX);
+        Arena_block *p=Malloc(sizeof(Arena_block)+n);
+        p->prev=b, p->size=n, p->used=0;
+        arena->block=b=p;
+    }
+    b->used+=size;
+
+    return b->data+b->used-size;
+}
+
+/* 只保留最近分配的最大內存塊以供重用 */
+void reset_arena(Arena *arena)
+{
+    if(arena->block)
+    {
+        Arena_block *b=arena->block->prev;
+        arena->block->prev=NULL, arena->block->used=0;
+        for(Arena_block *prev=NULL; b; b=prev)
+            prev=b->prev, free(b);
+    }
+}
+
+void free_arena(Arena *arena)
+{
+    reset_arena(arena);
+    Free(arena->block);
+}
+
+bool is_blank(const char *s)
+{
+    while(isspace((unsigned char)*s))
+        s++;
+    return *s == '\0';
+}
+
+Deck *create_deck(const char *name, Deck *parent)
+{
+    Deck *deck=Malloc(sizeof(Deck));
+    deck->name=cat_string(NULL, name);
+    deck->ndue=deck->nlearned=deck->nquiz=0;
+    deck->nright=0.0;
+    deck->parent=parent, deck->child=deck->sibling=NULL;
+    if(parent)
+    {
+        Deck **p=&parent->child;
+        while(*p)
+            p=&(*p)->sibling;
+        *p=deck;
+    }
+
+    return deck;
+}
+
+void free_decks(Deck *deck)
+{
+    for(Deck *p=deck->child, *next=NULL; p; p=next)
+        next=p->sibling, free_decks(p);
+    Free(deck->name);
+    Free(deck);
+}
+
+/* 按以/分隔的卡組路徑查找卡組，不存在時則創建之 */
+Deck *get_deck(Deck *root, const char *path)
+{
+    char name[LINE_MAX];
+    Deck *deck=root, *p=NULL;
+
+    while(*path)
+    {
+        int n=0;
+        while(isspace((unsigned char)*path) || *path=='/')
+            path++;
+        while(path[n] && path[n]!='/' && path[n]!='\n')
+            n++;
+        while(n>0 && isspace((unsigned char)path[n-1]))
+            n--;
+        if(n == 0)
+            break;
+        memcpy(name, path, n), name[n]='\0';
+        for(p=deck->child; p && strcmp(p->name, name); p=p->sibling)
+            ;
+        deck = p ? p : create_deck(name, deck);
+        while(*path && *path!='/')
+            path++;
+    }
+
+    return deck;
+}
+
+/* 把抽認卡的統計信息計入(sign爲1)或移出(sign爲-1)所屬卡組及其各級父卡組 */
+void count_flashcard(const Flashcard *fc, int sign)
+{
+    bool learned=is_long_term_memory(fc);
+    double nright=fc->right_rate*fc->nquiz/100;
+
+    for(Deck *p=fc->deck; p; p=p->parent)
+    {
+        p->ndue += learned ? 0 : sign;
+        p->nlearned += learned ? sign : 0;
+        p->nquiz += sign*fc->nquiz;
+        p->nright += sign*nright;
+    }
+}
+
+/* 調用者須保證buf足夠大 */
+char *format_deck_path(char *buf, const Deck *deck)
+{
+    if(deck->parent && deck->parent->parent)
+        strcat(format_deck_path(buf, deck->parent), "/");
+    else
+        buf[0]='\0';
+    return strcat(buf, deck->name);
+}
+
+void show_decks(const Deck *deck, int depth)
+{
+    double rate = deck->nquiz ? deck->nright*100/deck->nquiz : 0;
+
+    printf("%*s", depth*4, "");
+    printf(_("%s：待復習%d題，已掌握%d題，正確率爲%.0lf%%。\n"),
+        deck->parent ? deck->name : _("全部"), deck->ndue, deck->nlearned, rate);
+    for(const Deck *p=deck->child; p; p=p->sibling)
+        show_decks(p, depth+1);
+}
+
+void quiz(Flashcard *list)
+{
+    if(!has_flashcard(list))
+    {
+        free_flashcard(list);
+        die(_("數據文件不包含有效的抽認卡記錄！\n"));
+    }
+
+    for(Flashcard *p=list->next, *next=NULL; p; p=next)
+    {
+        if(!is_long_term_memory(p) && !p->dirty)
+            quiz_flashcard(list, p);
+        next=p->next;
+        if(reload_if_changed(list)) // p可能已被刪除，故從頭開始找未復習的抽認卡
+            next=list->next;
+        else if(unsorted && next==NULL) // 復習隊列已用完
+            merge_unsorted(list, true), next=list->next;
+#if HAVE_PTHREAD
+        else if(loader.running && merge_loaded(list, next==NULL)) // 新抽認卡可能排在p之前
+            next=list->next;
+#endif
+    }
+    puts(_("復習完成。"));
+    show_statistics(list);
+}
+
+/* 限時復習：按單位時間的預期記憶收益從高到低貪心地選取抽認卡。每答完一題
+ * 都按實際剩余時間和本次的平均答題用時重新判斷下一題能否在時限內答完 */
+void quiz_in_time(Flashcard *list, int minutes)
+{
+    if(!has_flashcard(list))
+    {
+        free_flashcard(list);
+        die(_("數據文件不包含有效的抽認卡記錄！\n"));
+    }
+
+    int n=0, nquiz=0;
+    double total=0, latency;
+    time_t deadline=time(NULL)+(time_t)minutes*60;
+    Candidate *c=NULL;
+
+    merge_unsorted(list, true);
+    c=collect_candidates(list, &n);
+
+    for(int i=0; i<n && time(NULL)<deadline; i++)
+    {
+        latency=c[i].fc->latency;
+        if(latency <= 0)
+            latency = nquiz ? total/nquiz : DEFAULT_LATENCY;
+        if(latency <= difftime(deadline, time(NULL)))
+            total+=quiz_flashcard(list, c[i].fc), nquiz++;
+        if(reload_if_changed(list)) // 候選抽認卡可能已被刪除，故重新選取
+            Free(c), c=collect_candidates(list, &n), i=-1;
+    }
+    Free(c);
+    puts(_("復習完成。"));
+    show_statistics(list);
+}
+
+/* 按單位時間的預期記憶收益從高到低排列未復習的抽認卡 */
+Candidate *collect_candidates(const Flashcard *list, int *n)
+{
+    Candidate *c=NULL;
+    double latency;
+    time_t now=time(NULL);
+
+    *n=0;
+    for(Flashcard *p=list->next; p; p=p->next)
+        (*n)++;
+    c=Malloc((*n+1)*sizeof(Candidate)), *n=0;
+    for(Flashcard *p=list->next; p; p=p->next)
+    {
+        if(is_long_term_memory(p) || p->dirty)
+            continue;
+        latency = p->latency>0 ? p->latency : DEFAULT_LATENCY;
+        c[*n].fc=p, c[(*n)++].value=forgetting_risk(p, now)/latency;
+    }
+    qsort(c, *n, sizeof(Candidate), cmp_candidate);
+
+    return c;
+}
+
+int cmp_candidate(const void *p1, const void *p2)
+{
+    double v1=((const Candidate *)p1)->value, v2=((const Candidate *)p2)->value;
+    return v1>v2 ? -1 : v1<v2;
+}
+
+/* 估計抽認卡已被遺忘的概率：以平滑後的錯誤率爲剛復習過時的遺忘概率，此後
+ * 記得的概率按冪函數遺忘曲線1/(1+t/S)隨距上次復習的時間t衰減。記憶穩定期S
+ * 隨連續答對次數加倍，故連續答對次數越多，則越不易遺忘 */
+double forgetting_risk(const Flashcard *fc, time_t now)
+{
+    double rate = fc->right_rate<0 ? 0 : (fc->right_rate>100 ? 100 : fc->right_rate);
+    double wrong=(fc->nquiz*(100-rate)/100+1)/(fc->nquiz+2);
+    double elapsed = now>fc->prev_time ? difftime(now, fc->prev_time) : 0;
+    int n = fc->n_contin_right<N_LONG_TERM_MEMORY ? fc->n_contin_right : N_LONG_TERM_MEMORY;
+    double stability=BASE_STABILITY*(1<<(n>0 ? n : 0));
+
+    return 1-(1-wrong)/(1+elapsed/stability);
+}
+
+/* 復習一個抽認卡，返回答題用時（單位：秒） */
+double quiz_flashcard(Flashcard *list, Flashcard *fc)
+{
+    time_t start=time(NULL);
+    bool right;
+    double latency;
+
+    reset_arena(&scratch);
+    show_question(get_question(fc));
+    input_question();
+    show_answer(get_answer(fc));
+    right=judge_answer();
+    latency=difftime(time(NULL), start);
+    fc->latency = fc->latency>0 ? (3*fc->latency+latency)/4 : latency;
+    eval_answer(fc, right);
+    update_statistics(list, right);
+
+    return latency;
+}
+
+void show_quiz_result(const Flashcard *list)
+{
+    for(Flashcard *p=list->next; p; p=p->next)
+    {
+        if(is_long_term_memory(p))
+            continue;
+    }
+}
+
+void show_question(const char *question)
+{
+    puts(_("問題："));
+    printf("%s", question);
+    puts(_("請輸入答案（以獨立一行<<<結束）："));
+    get_sys_cmd_and_exec(question);
+}
+
+void input_question(void)
+{
+    char line[LINE_MAX];
+    while(read_input(line, LINE_MAX))
+    {
+        exec_cmd(line); // 去掉首尾空白後再比較，行尾的\r或全角空格不影響結束標記
+        if(strcmp(line, "<<<\n") == 0)
+            return;
+    }
+}
+
+/* 讀入一行輸入，用法與fgets(line, size, stdin)相同。有事件循環時自行從標準
+ * 輸入讀入並緩衝，等待期間處理其他事件；stdio的緩衝對poll不可見，故不能
+ * 與fgets混用 */
+char *read_input(char *line, int size)
+{
+#if HAVE_TIMERFD
+    char *nl=NULL;
+    size_t n;
+    ssize_t r;
+
+    if(session.tfd == -1)
+        return read_stdin(line, size);
+    while(1)
+    {
+        check_quit(); // 沒有signalfd時poll被信號打斷後在此退出
+        struct pollfd fds[4+SESSION_CHILDREN]={{STDIN_FILENO, POLLIN, 0},
+            {session.tfd, POLLIN, 0}, {session.sfd, POLLIN, 0}, {inotify_fd, POLLIN, 0}};
+
+        nl=memchr(session.buf, '\n', session.len);
+        if(nl || session.len>=(size_t)size-1 || (session.eof && session.len))
+        {
+            n = nl ? (size_t)(nl-session.buf+1) : session.len;
+            n = n<(size_t)size-1 ? n : (size_t)size-1;
+            memcpy(line, session.buf, n), line[n]='\0';
+            memmove(session.buf, session.buf+n, session.len-n), session.len-=n;
+            return line;
+        }
+        if(session.eof)
+            return NULL;
+        for(int i=0; i<session.nchild; i++)
+            fds[4+i].fd=session.pidfds[i], fds[4+i].events=POLLIN;
+        if(poll(fds, 4+session.nchild, -1) == -1)
+            continue;
+        if(fds[0].revents)
+        {
+            r=read(STDIN_FILENO, session.buf+session.len, sizeof(session.buf)-session.len);
+            if(r > 0)
+                session.len+=r;
+            else if(r==0 || errno!=EINTR)
+                session.eof=true;
+        }
+        handle_events(fds, 4+session.nchild);
+    }
+#else
+    return read_stdin(line, size);
+#endif
+}
+
+/* 沒有事件循環時以fgets讀入，被信號打斷而返回時退出 */
+char *read_stdin(char *line, int size)
+{
+    char *s=NULL;
+
+    check_quit();
+    s=fgets(line, size, stdin);
+    check_quit();
+
+    return s;
+}
+
+#if HAVE_TIMERFD
+/* 打開交互復習的事件循環：SIGINT和SIGTERM改由signalfd接收，在事件循環中
+ * 正常退出並保存，不在信號處理函數中調用exit */
+void open_session(void)
+{
+    struct itimerspec t={{AUTOSAVE_INTERVAL, 0}, {AUTOSAVE_INTERVAL, 0}};
+
+    session.tfd=timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(session.tfd == -1)
+        return;
+    timerfd_settime(session.tfd, 0, &t, NULL);
+#if HAVE_SIGNALFD
+    sigset_t set;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT), sigaddset(&set, SIGTERM);
+    sigprocmask(SIG_BLOCK, &set, NULL);
+    session.sfd=signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(session.sfd == -1)
+        sigprocmask(SIG_UNBLOCK, &set, NULL);
+#endif
+}
+
+void close_session(void)
+{
+    if(session.tfd != -1)
+        close(session.tfd), session.tfd=-1;
+    if(session.sfd != -1)
+        close(session.sfd), session.sfd=-1;
+    for(int i=0; i<session.nchild; i++)
+        close(session.pidfds[i]);
+    session.nchild=0;
+}
+
+/* 處理等待輸入期間除標準輸入以外的事件。fds的前四項依次是標準輸入、定時器、
+ * signalfd和inotify，其後是各子進程的pidfd；fd爲-1的項poll會忽略 */
+void handle_events(const struct pollfd *fds, int n)
+{
+    uint64_t expirations;
+    char buf[4096];
+
+    if(fds[1].revents && read(session.tfd, &expirations, sizeof(expirations)) > 0)
+        sync_journal();
+#if HAVE_SIGNALFD
+    struct signalfd_siginfo info;
+
+    if(fds[2].revents && read(session.sfd, &info, sizeof(info)) > 0)
+        exit(EXIT_SUCCESS);
+#endif
+    if(fds[3].revents) // 讀走事件以免poll一直返回，改動留待答完本題後處理
+        while(read(inotify_fd, buf, sizeof(buf)) > 0)
+            data_changed=true;
+    for(int i=n-1; i>=4; i--) // 從後往前刪，未處理的項不會被挪動
+        if(fds[i].revents)
+        {
+#if HAVE_PIDFD
+            waitpid(session.pids[i-4], NULL, WNOHANG);
+#endif
+            close(session.pidfds[i-4]);
+            session.nchild--;
+            session.pids[i-4]=session.pids[session.nchild];
+            session.pidfds[i-4]=session.pidfds[session.nchild];
+        }
+}
+#endif
+
+/* 追蹤由命令行啓動的子進程，在其退出後由事件循環回收，以免積累僵屍進程。
+ * 不支持pidfd或追蹤的子進程已滿時不回收，與沒有事件循環時相同 */
+void track_child(pid_t pid)
+{
+#if HAVE_TIMERFD && HAVE_PIDFD && defined(SYS_pidfd_open)
+    int fd;
+
+    if(session.tfd==-1 || session.nchild==SESSION_CHILDREN
+        || (fd=syscall(SYS_pidfd_open, pid, 0)) == -1)
+        return;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    session.pids[session.nchild]=pid, session.pidfds[session.nchild++]=fd;
+#else
+    (void)pid;
+#endif
+}
+
+void show_answer(const char *answer)
+{
+    puts(_("答案："));
+    printf("%s", answer);
+    get_sys_cmd_and_exec(answer);
+}
+
+bool judge_answer(void)
+{
+    char line[LINE_MAX];
+    while(1)
+    {
+        puts(_("是否正確？(正確按y/錯誤按n）"));
+        if(read_input(line, LINE_MAX) == NULL) // 輸入已結束，按quit處理
+            exit(EXIT_SUCCESS);
+        exec_cmd(line);
+        if(strcmp(line, "y\n") == 0)
+            return true;
+        if(strcmp(line, "n\n") == 0)
+            return false;
+    }
+}
+
+void eval_answer(Flashcard *fc, bool right)
+{
+    count_flashcard(fc, -1);
+    update_statistics(fc, right);
+    count_flashcard(fc, 1);
+    fc->prev_time=time(NULL);
+    fc->dirty=true;
+    append_journal(fc);
+    show_statistics(fc);
+}
+
+void update_statistics(Flashcard *fc, bool right)
+{
+    double rate=fc->right_rate, n=fc->nquiz;
+
+    fc->nquiz++;
+    fc->n_contin_right = right ? fc->n_contin_right+1 : 0;
+
+    if(right)
+        fc->right_rate=(rate*n+100)/(n+1);
+    else if(rate > 0)
+        fc->right_rate=(rate*n-100)/(n+1);
+    else
+        fc->right_rate=0;
+}
+
+void show_statistics(const Flashcard *fc)
+{
+    bool is_head=fc->question;
+
+    if(is_head)
+        printf(_("共復習%d題，正確率爲%.0lf%%。\n\n"),
+            fc->nquiz, fc->right_rate);
+    else
+        printf(_("共復習%d次，連續答對%d次，正確率爲%.0lf%%。\n\n"),
+            fc->nquiz, fc->n_contin_right, fc->right_rate);
+}
+
+void get_sys_cmd_and_exec(const char *s)
+{
+    char *cmd=get_sys_cmd(s);
+    if(cmd)
+    {
+        exec_sys_cmd(cmd);
+        Free(cmd);
+    }
+}
+
+int exec_sys_cmd(const char *cmd)
+{
+#if HAVE_FORK && HAVE_EXECL
+#include <unistd.h>
+#include <sys/types.h>
+    pid_t pid=fork();
+    if(pid == -1)
+        return EXIT_FAILURE;
+    else if(pid == 0)
+    {
+#if HAVE_SIGNALFD
+        sigset_t set; // 事件循環屏蔽了的信號在命令中應照常生效
+
+        sigemptyset(&set);
+        sigaddset(&set, SIGINT), sigaddset(&set, SIGTERM);
+        sigprocmask(SIG_UNBLOCK, &set, NULL);
+#endif
+        execl("/bin/sh", "sh", "-c", cmd, NULL);
+        _exit(EXIT_FAILURE); // 不能經由atexit保存數據文件
+    }
+    track_child(pid);
+    return EXIT_SUCCESS;
+#else
+    if(!system(NULL))
+        return EXIT_FAILURE;
+    printf(_("# 正在執行系統命令……"));
+    fflush(stdout); // 因爲上邊的語言沒有'\n'
+    int ret=system(cmd);
+    puts(_("完畢。"));
+    return ret;
+#endif
+}
+
+char *get_sys_cmd(const char *s)
+{
+    int n=strlen(s)+1;
+    char *cmd=Malloc(n), *c=cmd;
+
+    memset(cmd, '\0', n);
+
+    // 以:開頭行均視爲命令行
+    for(const char *start=NULL, *p=s; *p; p++)
+        if( (p==s && *p==':' && *(start=p+1))
+            || (*p=='\n' && *(p+1)==':' && *(start=p+2)) )
+            for(const char *q=start; *q && *q!='\n'; c++, q++)
+               *c=*q; 
+
+    if(cmd[0] == '\0')
+        Free(cmd);
+
+    return cmd;
+}
+
+void exec_cmd(char *cmd)
+{
+    trim_cmd(cmd);
+
+    if(strcmp(cmd, "help\n") == 0)
+        help();
+    else if(strcmp(cmd, "quit\n") == 0)
+        exit(EXIT_SUCCESS);
+    else if(strcmp(cmd, "temp\n") == 0)
+        show_template();
+    else if(strcmp(cmd, "clear\n") == 0)
+        clear_screen();
+    else if(strcmp(cmd, "deck\n")==0 && flashcards)
+        show_decks(flashcards->deck, 0);
+}
+
+/* 去掉命令首尾的空白和控制字符，行尾去掉了字符時補上換行符，與命令的寫法
+ * 一致。輸入法處於全角狀態時輸入的全角ASCII字符先轉成半角。整行都是ASCII
+ * 字符時不必解碼UTF-8 */
+char *trim_cmd(char *cmd)
+{
+    size_t len=strlen(cmd), n;
+    char *p=cmd, *end=NULL, *q=NULL;
+
+    if(!is_ascii(cmd, len))
+        len=fold_fullwidth(cmd);
+    end=cmd+len;
+    while(p<end && (n=space_len(p, end)))
+        p+=n;
+    for(q=end; q>p; end=q)
+    {
+        while(--q>p && ((unsigned char)*q & 0xc0)==0x80) // 退到上一個字符的開頭
+            ;
+        if(space_len(q, end) != (size_t)(end-q))
+            break;
+    }
+    memmove(cmd, p, end-p);
+    if(end < cmd+len)
+        cmd[end-p]='\n', end++;
+    cmd[end-p]='\0';
+
+    return cmd;
+}
+
+/* s處的字符若是空白或控制字符則返回其字節數，否則返回0。除ASCII的空白和控制
+ * 字符外，還識別C1控制字符、U+00A0、U+1680、U+2000至U+200A、U+2028、U+2029、
+ * U+202F、U+205F、U+3000這些Unicode空白以及字節順序標記U+FEFF */
+size_t space_len(const char *s, const char *end)
+{
+    const unsigned char *p=(const unsigned char *)s;
+
+    if(p[0] < 0x80)
+        return p[0]<=' ' || p[0]==0x7f;
+    if(end-s>=2 && p[0]==0xc2 && p[1]>=0x80 && p[1]<=0xa0)
+        return 2;
+    if(end-s < 3)
+        return 0;
+    if((p[0]==0xe1 && p[1]==0x9a && p[2]==0x80)
+        || (p[0]==0xe2 && p[1]==0x80 && (p[2]<=0x8a || p[2]==0xa8 || p[2]==0xa9 || p[2]==0xaf))
+        || (p[0]==0xe2 && p[1]==0x81 && p[2]==0x9f)
+        || (p[0]==0xe3 && p[1]==0x80 && p[2]==0x80)
+        || (p[0]==0xef && p[1]==0xbb && p[2]==0xbf))
+        return 3;
+
+    return 0;
+}
+
+/* 把全角ASCII字符U+FF01至U+FF5E就地轉成對應的半角字符，返回轉換後的長度 */
+size_t fold_fullwidth(char *s)
+{
+    unsigned char *r=(unsigned char *)s, *w=r;
+
+    while(*r)
+    {
+        if(r[0]==0xef && r[1]==0xbc && r[2]>=0x81 && r[2]<=0xbf)
+            *w++=r[2]-0x81+'!', r+=3;
+        else if(r[0]==0xef && r[1]==0xbd && r[2]>=0x80 && r[2]<=0x9e)
+            *w++=r[2]-0x80+'`', r+=3;
+        else
+            *w++=*r++;
+    }
+    *w='\0';
+
+    return w-(unsigned char *)s;
+}
+
+/* 把行尾的\r\n換成\n，以便讀入在Windows下編輯過的數據文件。返回行的長度 */
+size_t strip_cr(char *line)
+{
+    size_t n=strlen(line);
+
+    if(n>=2 && line[n-2]=='\r' && line[n-1]=='\n')
+        line[n-2]='\n', line[--n]='\0';
+
+    return n;
+}
+
+/* 把分段讀入的過長的行的後續一段接在*dest之後。上一段以\r結束而本段以\n開始
+ * 時，與strip_cr一樣合成一個\n */
+void append_chunk(char **dest, const char *line)
+{
+    size_t n=strlen(*dest);
+
+    if(line[0]=='\n' && n && (*dest)[n-1]=='\r')
+        (*dest)[n-1]='\0';
+    *dest=cat_string(*dest, line);
+}
+
+/* 檢查s的前n個字節是否是有效的UTF-8文字，拒絕過長的編碼、代理項和大於
+ * U+10FFFF的碼位 */
+bool is_valid_utf8(const char *s, size_t n)
+{
+    Utf8_state state={ 0, 0x80, 0xbf };
+
+    return check_utf8(&state, s, n) && state.need==0;
+}
+
+/* 接着state檢查s的前n個字節，末尾未完的字符記在state中由下一段接着解碼，
+ * 分段讀入的長行因此不會在多字節字符中間被誤報。出錯後從出錯的字節重新
+ * 開始解碼。全是ASCII字符時由is_ascii一次判定，不必逐字節解碼 */
+bool check_utf8(Utf8_state *state, const char *s, size_t n)
+{
+    const unsigned char *p=(const unsigned char *)s, *end=p+n;
+    bool ok=true;
+
+    if(state->need==0 && is_ascii(s, n))
+        return true;
+    for(; p<end; p++)
+    {
+        if(state->need)
+        {
+            if(*p>=state->lo && *p<=state->hi)
+            {
+                state->need--, state->lo=0x80, state->hi=0xbf;
+                continue;
+            }
+            state->need=0, state->lo=0x80, state->hi=0xbf, ok=false;
+        }
+        if(*p < 0x80)
+            ;
+        else if(*p>=0xc2 && *p<=0xdf)
+            state->need=1;
+        else if(*p>=0xe0 && *p<=0xef)
+        {
+            state->need=2;
+            state->lo = *p==0xe0 ? 0xa0 : 0x80, state->hi = *p==0xed ? 0x9f : 0xbf;
+        }
+        else if(*p>=0xf0 && *p<=0xf4)
+        {
+            state->need=3;
+            state->lo = *p==0xf0 ? 0x90 : 0x80, state->hi = *p==0xf4 ? 0x8f : 0xbf;
+        }
+        else
+            ok=false;
+    }
+
+    return ok;
+}
+
+/* 以每次8字節的方式檢查s的前n個字節是否都是ASCII字符 */
+bool is_ascii(const char *s, size_t n)
+{
+    uint64_t w;
+    size_t i=0;
+
+    for(; i+8<=n; i+=8)
+    {
+        memcpy(&w, s+i, 8);
+        if(w & 0x8080808080808080ULL)
+            return false;
+    }
+    for(; i<n; i++)
+        if((unsigned char)s[i] & 0x80)
+            return false;
+
+    return true;
+}
+
+void clear_screen(void)
+{
+#ifdef ANSI_ESCAPE
+    puts("[2J");
+#else
+    for(int i=0; i<100; i++)
+        puts("");
+#endif
+}
+
+void quit(void)
+{
+#if HAVE_PTHREAD
+    if(loader.running && flashcards)
+    {
+        if(pthread_equal(pthread_self(), loader.thread)) // 解析線程出錯退出，鏈表不完整，不能保存
+            return;
+        finish_loading(flashcards);
+    }
+#endif
+    if(has_flashcard(flashcards))
+    {
+        double start=get_seconds();
+        merge_unsorted(flashcards, false);
+        reload_if_changed(flashcards);
+        sort_flashcard(flashcards);
+#if HAVE_ZLIB
+        if(archiving && nvolume==0)
+            archive_flashcards(flashcards);
+#endif
+        if(update_data_file(flashcards, data_file))
+        {
+            commit_journal();
+            if(nvolume == 0) // 分卷時不用隊列，見load_flashcard
+                save_queue(flashcards);
+        }
+        profile.save_time=get_seconds()-start;
+    }
+    else if(journal)
+        fclose(journal), journal=NULL;
+    if(profiling)
+        show_profile();
+#if HAVE_TIMERFD
+    close_session();
+#endif
+    if(flashcards)
+        free_flashcards(flashcards);
+    if(journal_file)
+        Free(journal_file);
+    free_volumes();
+    if(text_cache.fp)
+        fclose(text_cache.fp), text_cache.fp=NULL;
+#if HAVE_ZLIB
+    free_packer();
+#endif
+    free_arena(&scratch);
+    exit(EXIT_SUCCESS);
+}
+
+/* 保存數據文件。分卷時只重寫有抽認卡改動過的卷，清單不變 */
+bool update_data_file(const Flashcard *list, const char *data_file)
+{
+    bool ok=true;
+
+    if(nvolume == 0)
+        return write_data_file(list, data_file, -1);
+    for(const Flashcard *p=list->next; p; p=p->next)
+        if(p->dirty)
+            volumes[p->owner ? p->owner->volume : p->volume].changed=true;
+    for(int i=0; i<nvolume; i++)
+        if(volumes[i].changed)
+        {
+            ok = write_data_file(list, volumes[i].filename, i) && ok;
+            volumes[i].changed=false;
+        }
+
+    return ok;
+}
+
+/* 把第volume卷的抽認卡寫入filename，volume爲負時寫入全部抽認卡。先寫入臨時
+ * 文件再改名替換，以免保存中途被中斷時毀掉原文件。文件爲符號鏈接時替換其
+ * 目標。低內存模式下抽認卡的文字要從原數據文件讀回，因此也不能就地改寫。
+ * 抽認卡按SAVE_SHARD個一片分給多個線程序列化，主線程按次序把已完成的各片
+ * 一併寫入。只有一個線程時主線程序列化一片就寫一片，內存中至多有在途的和
+ * 正在序列化的兩片 */
+bool write_data_file(const Flashcard *list, const char *filename, int volume)
+{
+    char *path=realpath(filename, NULL);
+    char *tmp=cat_string(cat_string(NULL, path ? path : filename), ".tmp");
+    int fd=open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    struct stat *st = volume<0 ? &data_stat : &volumes[volume].st;
+    const char *comment = volume<0 ? list->comment : volumes[volume].comment;
+    const char *trailer = volume<0 ? list->answer : volumes[volume].trailer;
+    Save_pool pool;
+    Shard_writer writer;
+    long ncard=0, nthread=1;
+    bool ok=true;
+
+    if(fd == -1)
+        die(_("打開文件失敗：%s\n"), tmp);
+    fchmod(fd, st->st_mode & 07777);
+    for(const Flashcard *p=list->next; p; p=p->next)
+        ncard += in_volume(p, volume);
+    pool.n=(ncard+SAVE_SHARD-1)/SAVE_SHARD, pool.next=0, pool.root=list->deck;
+    pool.volume=volume;
+    pool.shards=Malloc((pool.n ? pool.n : 1)*sizeof(Save_shard));
+    ncard=0;
+    for(Flashcard *p=list->next; p; p=p->next)
+        if(in_volume(p, volume))
+        {
+            Save_shard *s=pool.shards+ncard++/SAVE_SHARD;
+            if((ncard-1)%SAVE_SHARD == 0)
+                s->first=p, s->n=0, s->buf=NULL, s->size=0, s->done=false;
+            s->n++;
+        }
+
+#if HAVE_PTHREAD
+    pthread_t *threads=NULL;
+
+    /* 低內存模式和壓縮模式下讀回文字要經過共享的緩存和解壓器，只能單線程 */
+    if(text_cache.capacity==0 && pool.n>1)
+    {
+        nthread=sysconf(_SC_NPROCESSORS_ONLN);
+        nthread = nthread<1 ? 1 : (nthread>pool.n ? pool.n : nthread);
+    }
+    pthread_mutex_init(&pool.mutex, NULL);
+    pthread_cond_init(&pool.cond, NULL);
+    if(nthread > 1)
+    {
+        threads=Malloc(nthread*sizeof(pthread_t));
+        for(long i=0; i<nthread; i++)
+            if(pthread_create(&threads[i], NULL, save_worker, &pool))
+                die(_("不能創建線程\n"));
+    }
+#endif
+
+    open_shard_writer(&writer, fd);
+    writer.iov[0].iov_base=(char *)comment, writer.iov[0].iov_len=strlen(comment);
+    submit_shards(&writer, 1);
+    for(int i=0, j=0, prev=0; i<pool.n; prev=i, i=j) // 邊序列化邊寫入
+    {
+        if(nthread == 1)
+            pool.shards[i].ok=save_shard(&pool, &pool.shards[i]), j=i+1;
+#if HAVE_PTHREAD
+        else
+        {
+            pthread_mutex_lock(&pool.mutex);
+            while(!pool.shards[i].done)
+                pthread_cond_wait(&pool.cond, &pool.mutex);
+            for(j=i; j<pool.n && j-i<SAVE_IOV && pool.shards[j].done; j++)
+                ;
+            pthread_mutex_unlock(&pool.mutex);
+        }
+#endif
+        finish_shards(&writer); // 上一批寫完才能釋放其內容、重用iov
+        for(int k=prev; k<i; k++)
+            Free(pool.shards[k].buf);
+        for(int k=i; k<j; k++)
+        {
+            writer.iov[k-i].iov_base=pool.shards[k].buf;
+            writer.iov[k-i].iov_len=pool.shards[k].size;
+            ok = ok && pool.shards[k].ok;
+        }
+        submit_shards(&writer, j-i);
+    }
+    finish_shards(&writer);
+    for(int k=0; k<pool.n; k++)
+        Free(pool.shards[k].buf);
+    if(trailer)
+    {
+        writer.iov[0].iov_base=(char *)trailer, writer.iov[0].iov_len=strlen(trailer);
+        submit_shards(&writer, 1);
+    }
+    ok = close_shard_writer(&writer) && ok;
+#if HAVE_PTHREAD
+    for(long i=0; threads && i<nthread; i++)
+        pthread_join(threads[i], NULL);
+    pthread_cond_destroy(&pool.cond);
+    pthread_mutex_destroy(&pool.mutex);
+    Free(threads);
+#endif
+    Free(pool.shards);
+
+    ok = ok && fsync(fd)==0;
+    ok = close(fd)==0 && ok && rename(tmp, path ? path : filename)==0
+        && sync_parent_dir(path ? path : filename);
+    if(!ok)
+    {
+        fprintf(stderr, _("保存數據文件失敗：%s\n"), filename);
+        remove(tmp);
+    }
+    else
+        stat(filename, st);
+    free(path);
+    Free(tmp);
+
+    return ok;
+}
+
+/* 抽認卡是否擁有文字、未歸檔並且在第volume卷中，volume爲負時不論在哪一卷 */
+bool in_volume(const Flashcard *fc, int volume)
+{
+    return fc->owner==NULL && !fc->archived && (volume<0 || fc->volume==volume);
+}
+
+/* 寫入抽認卡記錄及其派生抽認卡的統計信息。校驗和覆蓋記錄開始標記之後、
+ * 校驗標記之前的全部內容。讀不回抽認卡的文字時返回false */
+bool write_record(FILE *fp, Flashcard *fc, const Deck *root)
+{
+    char buf[LINE_MAX];
+    uint32_t crc=0;
+
+    if(!load_text(fc))
+        return false;
+
+    fputs("\n", fp);
+    fputs(">>\n", fp);
+    put_string(fc->comment, fp, &crc);
+    if(fc->deck != root)
+    {
+        put_string("D:\n    ", fp, &crc);
+        put_string(format_deck_path(buf, fc->deck), fp, &crc);
+        put_string("\n", fp, &crc);
+    }
+    put_string("Q:\n", fp, &crc);
+    put_string(fc->question, fp, &crc);
+    put_string("A:\n", fp, &crc);
+    put_string(fc->answer, fp, &crc);
+    put_string("S:\n", fp, &crc);
+    put_string(format_info(buf, fc), fp, &crc);
+    for(const Flashcard *v=fc->variant; v; v=v->variant)
+        if(!v->reverse)
+            put_string(format_info(buf, v), fp, &crc);
+    for(const Flashcard *v=fc->variant; v; v=v->variant)
+        if(v->reverse)
+            put_string("R:\n", fp, &crc), put_string(format_info(buf, v), fp, &crc);
+    if(fc->checksum)
+        fprintf(fp, "C:\n    %08lx\n", (unsigned long)crc);
+    fputs("<<\n", fp);
+
+    return true;
+}
+
+void put_string(const char *s, FILE *fp, uint32_t *crc)
+{
+    size_t n=strlen(s);
+    fwrite(s, 1, n, fp);
+    *crc=crc32c(*crc, s, n);
+}
+
+/* 與sprintf(buf, "    %d %d %g %lld %lld %g\n", ...)的結果相同，但不必解析格式；
+ * 填空抽認卡另在行首寫入c序號。time_t不一定是unsigned long，時間一律按long long寫入 */
+char *format_info(char *buf, const Flashcard *fc)
+{
+    char *p=buf;
+
+    memcpy(p, "    ", 4), p+=4;
+    if(fc->cloze)
+        *p++='c', p=format_llong(p, fc->cloze), *p++=' ';
+    p=format_llong(p, fc->nquiz), *p++=' ';
+    p=format_llong(p, fc->n_contin_right), *p++=' ';
+    p=format_double(p, fc->right_rate), *p++=' ';
+    p=format_llong(p, (long long)fc->prev_time), *p++=' ';
+    p=format_llong(p, (long long)fc->next_time), *p++=' ';
+    p=format_double(p, fc->latency);
+    *p++='\n', *p='\0';
+
+    return buf;
+}
+
+/* 寫入n的十進制形式，返回寫入內容之後的位置，不寫入結尾的空字符 */
+char *format_llong(char *p, long long n)
+{
+    if(n < 0)
+        *p++='-';
+    return format_ullong(p, n<0 ? -(unsigned long long)n : (unsigned long long)n);
+}
+
+char *format_ullong(char *p, unsigned long long n)
+{
+    char digits[24];
+    int len=0;
+
+    do
+        digits[len++]='0'+n%10;
+    while(n/=10);
+    while(len)
+        *p++=digits[--len];
+
+    return p;
+}
+
+/* 按%g的格式寫入x，返回寫入內容之後的位置。常見的取值直接舍入到6位有效數字，
+ * 需要指數形式或乘法的誤差可能影響舍入方向時交給sprintf */
+char *format_double(char *p, double x)
+{
+    static const double scale[]={1e9, 1e8, 1e7, 1e6, 1e5, 1e4, 1e3, 1e2, 1e1, 1e0};
+    char digits[24];
+    unsigned long long r;
+    double y;
+    int e=5, len;
+
+    if(x==0 && !signbit(x))
+    {
+        *p++='0';
+        return p;
+    }
+    if(!(x>=1e-4 && x<1e6))
+        return p+sprintf(p, "%g", x);
+    while(e>-4 && x*scale[e+4]<1e5) // 找出x的十進制指數e，使y有6位整數
+        e--;
+    y=x*scale[e+4];
+    r=(unsigned long long)y;
+    if(y-r>0.5-1e-6 && y-r<0.5+1e-6)
+        return p+sprintf(p, "%g", x);
+    r+=y-r>0.5;
+    if(r >= 1000000) // 進位後多了一位
+    {
+        r/=10;
+        if(++e == 6)
+            return p+sprintf(p, "%g", x);
+    }
+
+    len=format_ullong(digits, r)-digits;
+    while(len>e+1 && digits[len-1]=='0')
+        len--;
+    if(e >= 0)
+    {
+        memcpy(p, digits, e+1), p+=e+1;
+        if(len > e+1)
+            *p++='.', memcpy(p, digits+e+1, len-e-1), p+=len-e-1;
+    }
+    else
+    {
+        *p++='0', *p++='.';
+        memset(p, '0', -e-1), p+=-e-1;
+        memcpy(p, digits, len), p+=len;
+    }
+
+    return p;
+}
+
+/* 每次領取一個分片，把其中的抽認卡序列化到內存流中 */
+void *save_worker(void *arg)
+{
+    Save_pool *pool=arg;
+
+    while(1)
+    {
+        Save_shard *s=NULL;
+        bool ok;
+#if HAVE_PTHREAD
+        pthread_mutex_lock(&pool->mutex);
+        if(pool->next < pool->n)
+            s=&pool->shards[pool->next++];
+        pthread_mutex_unlock(&pool->mutex);
+#else
+        if(pool->next < pool->n)
+            s=&pool->shards[pool->next++];
+#endif
+        if(s == NULL)
+            return NULL;
+
+        ok=save_shard(pool, s);
+#if HAVE_PTHREAD
+        pthread_mutex_lock(&pool->mutex);
+        s->ok=ok, s->done=true;
+        pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->mutex);
+#else
+        s->ok=ok, s->done=true;
+#endif
+    }
+}
+
+/* 把分片中的抽認卡序列化到內存流中，返回是否成功 */
+bool save_shard(const Save_pool *pool, Save_shard *s)
+{
+    FILE *fp=open_memstream(&s->buf, &s->size);
+    Flashcard *p=s->first;
+    bool ok = fp!=NULL;
+
+    for(int k=0; k<s->n && ok; p=p->next)
+        if(in_volume(p, pool->volume))
+            ok=write_record(fp, p, pool->root), k++;
+    if(fp && fclose(fp))
+        ok=false;
+
+    return ok;
+}
+
+/* 依次寫入各段內容，並把offset移到寫入的內容之後。出錯時返回false */
+bool write_shards(int fd, struct iovec *iov, int n, off_t *offset)
+{
+    ssize_t len;
+
+    while(n > 0)
+    {
+        if((len=pwritev(fd, iov, n, *offset))<0 && errno==EINTR)
+            continue;
+        if(len < 0)
+            return false;
+        *offset+=len;
+        n=skip_iov(&iov, n, len);
+    }
+
+    return true;
+}
+
+/* 跳過各段內容中已寫入的前len字節，返回餘下的段數 */
+int skip_iov(struct iovec **iov, int n, size_t len)
+{
+    for(; n>0 && len>=(*iov)->iov_len; n--, (*iov)++)
+        len-=(*iov)->iov_len;
+    if(n > 0)
+        (*iov)->iov_base=(char *)(*iov)->iov_base+len, (*iov)->iov_len-=len;
+
+    return n;
+}
+
+void open_shard_writer(Shard_writer *w, int fd)
+{
+    w->fd=fd, w->offset=0, w->n=0, w->ok=true;
+#if HAVE_IO_URING
+    if((w->use_ring=init_uring(&w->ring, 1)))
+        profile.save_uring=true;
+#endif
+}
+
+/* 寫入w->iov中的前n段內容。用io_uring時只提交寫請求，由finish_shards等待
+ * 其完成，期間iov和各段內容都不能改動；否則以pwritev同步寫入 */
+void submit_shards(Shard_writer *w, int n)
+{
+#if HAVE_IO_URING
+    if(w->use_ring && w->ok && n>0)
+    {
+        Uring *r=&w->ring;
+        unsigned tail=*r->sq_tail, idx=tail & *r->sq_mask;
+        struct io_uring_sqe *sqe=r->sqes+idx;
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode=IORING_OP_WRITEV;
+        sqe->fd=w->fd;
+        sqe->addr=(uintptr_t)w->iov;
+        sqe->len=n;
+        sqe->off=w->offset;
+        r->sq_array[idx]=idx;
+        __atomic_store_n(r->sq_tail, tail+1, __ATOMIC_RELEASE);
+        w->n=n;
+        while(syscall(__NR_io_uring_enter, r->fd, 1, 0, 0, NULL, 0) < 0)
+            if(errno != EINTR)
+                die(_("提交異步I/O請求失敗\n"));
+        return;
+    }
+#endif
+    w->ok = w->ok && write_shards(w->fd, w->iov, n, &w->offset);
+}
+
+/* 等待在途的寫請求完成。io_uring不支持該操作、出錯或只寫了一部分時，以
+ * pwritev補寫餘下的內容 */
+void finish_shards(Shard_writer *w)
+{
+#if HAVE_IO_URING
+    Uring *r=&w->ring;
+    struct iovec *iov=w->iov;
+    int n=w->n;
+    unsigned head;
+    int res;
+
+    if(n == 0)
+        return;
+    while((head=*r->cq_head) == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        if(syscall(__NR_io_uring_enter, r->fd, 0, 1, IORING_ENTER_GETEVENTS,
+            NULL, 0)<0 && errno!=EINTR)
+            die(_("等待異步I/O請求失敗\n"));
+    res=r->cqes[head & *r->cq_mask].res;
+    __atomic_store_n(r->cq_head, head+1, __ATOMIC_RELEASE);
+    w->n=0;
+    if(res > 0)
+        w->offset+=res, n=skip_iov(&iov, n, res);
+    w->ok=write_shards(w->fd, iov, n, &w->offset);
+#else
+    (void)w;
+#endif
 }
 
-void show_statistics(const Flashcard *fc)
+/* 寫完在途的內容並釋放io_uring，不關閉文件。返回是否都寫入成功 */
+bool close_shard_writer(Shard_writer *w)
 {
-    bool is_head=fc->question;
+    finish_shards(w);
+#if HAVE_IO_URING
+    if(w->use_ring)
+        free_uring(&w->ring);
+#endif
 
-    if(is_head)
-        printf(_("共復習%d題，正確率爲%.0lf%%。\n\n"),
-            fc->nquiz, fc->right_rate);
-    else
-        printf(_("共復習%d次，連續答對%d次，正確率爲%.0lf%%。\n\n"),
-            fc->nquiz, fc->n_contin_right, fc->right_rate);
+    return w->ok;
 }
 
-void get_sys_cmd_and_exec(const char *s)
+/* 以io_uring讓各請求同時在途，不可用時則在提交時同步讀取 */
+void open_aio(Aio *aio, int fd)
 {
-    char *cmd=get_sys_cmd(s);
-    if(cmd)
+    aio->fd=fd, aio->failed=false;
+    for(int i=0; i<AIO_DEPTH; i++)
     {
-        exec_sys_cmd(cmd);
-        Free(cmd);
+        aio->slots[i].buf=Malloc(AIO_BLOCK);
+        aio->slots[i].len=0, aio->slots[i].offset=0;
+        aio->slots[i].busy=false;
     }
+#if HAVE_IO_URING
+    aio->use_ring=init_uring(&aio->ring, AIO_DEPTH);
+#endif
 }
 
-int exec_sys_cmd(const char *cmd)
+/* 等待所有請求完成後釋放資源，不關閉所讀寫的文件 */
+void close_aio(Aio *aio)
 {
-#if HAVE_FORK && HAVE_EXECL
-#include <unistd.h>
-#include <sys/types.h>
-    pid_t pid=fork();
-    if(pid == -1)
-        return EXIT_FAILURE;
-    else if(pid == 0)
+    for(int i=0; i<AIO_DEPTH; i++)
     {
-        execl("/bin/sh", "sh", "-c", cmd, NULL);
-        exit(EXIT_FAILURE);
+        wait_aio(aio, i);
+        Free(aio->slots[i].buf);
     }
-    return EXIT_SUCCESS;
-#else
-    if(!system(NULL))
-        return EXIT_FAILURE;
-    printf(_("# 正在執行系統命令……"));
-    fflush(stdout); // 因爲上邊的語言沒有'\n'
-    int ret=system(cmd);
-    puts(_("完畢。"));
-    return ret;
+#if HAVE_IO_URING
+    if(aio->use_ring)
+        free_uring(&aio->ring);
 #endif
 }
 
-char *get_sys_cmd(const char *s)
+void submit_aio(Aio *aio, int i)
 {
-    int n=strlen(s)+1;
-    char *cmd=Malloc(n), *c=cmd;
+    Aio_slot *s=aio->slots+i;
 
-    memset(cmd, '\0', n);
+#if HAVE_IO_URING
+    if(aio->use_ring)
+    {
+        Uring *r=&aio->ring;
+        unsigned tail=*r->sq_tail, idx=tail & *r->sq_mask;
+        struct io_uring_sqe *sqe=r->sqes+idx;
 
-    // 以:開頭行均視爲命令行
-    for(const char *start=NULL, *p=s; *p; p++)
-        if( (p==s && *p==':' && *(start=p+1))
-            || (*p=='\n' && *(p+1)==':' && *(start=p+2)) )
-            for(const char *q=start; *q && *q!='\n'; c++, q++)
-               *c=*q; 
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode=IORING_OP_READ;
+        sqe->fd=aio->fd;
+        sqe->addr=(uintptr_t)s->buf;
+        sqe->len=s->len;
+        sqe->off=s->offset;
+        sqe->user_data=i;
+        r->sq_array[idx]=idx;
+        __atomic_store_n(r->sq_tail, tail+1, __ATOMIC_RELEASE);
+        s->busy=true;
+        while(syscall(__NR_io_uring_enter, r->fd, 1, 0, 0, NULL, 0) < 0)
+            if(errno != EINTR)
+                die(_("提交異步I/O請求失敗\n"));
+        return;
+    }
+#endif
+    finish_aio(aio, i, read_all(aio->fd, s->buf, s->len, s->offset));
+}
 
-    if(cmd[0] == '\0')
-        Free(cmd);
+void wait_aio(Aio *aio, int i)
+{
+#if HAVE_IO_URING
+    Uring *r=&aio->ring;
 
-    return cmd;
+    while(aio->slots[i].busy)
+    {
+        unsigned head=*r->cq_head;
+        const struct io_uring_cqe *cqe=NULL;
+
+        if(head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            if(syscall(__NR_io_uring_enter, r->fd, 0, 1, IORING_ENTER_GETEVENTS,
+                NULL, 0)<0 && errno!=EINTR)
+                die(_("等待異步I/O請求失敗\n"));
+            continue;
+        }
+        cqe=r->cqes+(head & *r->cq_mask);
+        finish_aio(aio, (int)cqe->user_data, cqe->res);
+        __atomic_store_n(r->cq_head, head+1, __ATOMIC_RELEASE);
+    }
+#else
+    (void)aio, (void)i;
+#endif
 }
 
-void exec_cmd(char *cmd)
+/* 記錄請求的結果。io_uring不支持該操作或只讀了一部分時，以同步讀取補完 */
+void finish_aio(Aio *aio, int i, ssize_t res)
 {
-    trim_cmd(cmd);
+    Aio_slot *s=aio->slots+i;
+    ssize_t more;
 
-    if(strcmp(cmd, "help\n") == 0)
-        help();
-    else if(strcmp(cmd, "quit\n") == 0)
-        exit(EXIT_SUCCESS);
-    else if(strcmp(cmd, "temp\n") == 0)
-        show_template();
-    else if(strcmp(cmd, "clear\n") == 0)
-        clear_screen();
+    s->busy=false;
+    if(res < 0)
+        res=read_all(aio->fd, s->buf, s->len, s->offset);
+    else if((size_t)res < s->len)
+    {
+        more=read_all(aio->fd, s->buf+res, s->len-res, s->offset+res);
+        res = more<0 ? -1 : res+more;
+    }
+    if(res < 0)
+        aio->failed=true;
+    else
+        s->len=res;
 }
 
-char *trim_cmd(char *cmd)
+/* 讀到len字節或文件末尾爲止，返回實際讀取的字節數，出錯時返回-1 */
+ssize_t read_all(int fd, char *buf, size_t len, off_t offset)
 {
-    for(char *p=cmd; p && *p; p++)
-        if(isgraph(*p))
-            { memmove(cmd, p, strlen(p)+1); break; }
+    size_t done=0;
+    ssize_t n;
 
-    for(int i=strlen(cmd)-2; i>=0 ; i--)
-        if(isgraph(cmd[i]))
-            { cmd[i+1]='\n'; cmd[i+2]='\0'; break; }
+    while(done < len)
+    {
+        n=pread(fd, buf+done, len-done, offset+done);
+        if(n<0 && errno==EINTR)
+            continue;
+        if(n < 0)
+            return -1;
+        if(n == 0)
+            break;
+        done+=n;
+    }
 
-    return cmd;
+    return done;
 }
 
-void clear_screen(void)
+#if HAVE_IO_URING
+bool init_uring(Uring *r, unsigned entries)
 {
-#ifdef ANSI_ESCAPE
-    puts("[2J");
-#else
-    for(int i=0; i<100; i++)
-        puts("");
-#endif
+    struct io_uring_params p;
+    char *sq=NULL, *cq=NULL;
+
+    memset(&p, 0, sizeof(p));
+    r->sq_ring=r->cq_ring=r->sqes=MAP_FAILED;
+    if((r->fd=syscall(__NR_io_uring_setup, entries, &p)) < 0)
+        return false;
+    r->sq_ring_size=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+    r->cq_ring_size=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+    if((p.features & IORING_FEAT_SINGLE_MMAP) && r->cq_ring_size>r->sq_ring_size)
+        r->sq_ring_size=r->cq_ring_size;
+    r->sqes_size=p.sq_entries*sizeof(struct io_uring_sqe);
+
+    r->sq_ring=mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        r->fd, IORING_OFF_SQ_RING);
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+        r->cq_ring=r->sq_ring;
+    else
+        r->cq_ring=mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            r->fd, IORING_OFF_CQ_RING);
+    r->sqes=mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        r->fd, IORING_OFF_SQES);
+    if(r->sq_ring==MAP_FAILED || r->cq_ring==MAP_FAILED || r->sqes==MAP_FAILED)
+    {
+        free_uring(r);
+        return false;
+    }
+
+    sq=r->sq_ring, cq=r->cq_ring;
+    r->sq_head=(unsigned *)(sq+p.sq_off.head);
+    r->sq_tail=(unsigned *)(sq+p.sq_off.tail);
+    r->sq_mask=(unsigned *)(sq+p.sq_off.ring_mask);
+    r->sq_array=(unsigned *)(sq+p.sq_off.array);
+    r->cq_head=(unsigned *)(cq+p.cq_off.head);
+    r->cq_tail=(unsigned *)(cq+p.cq_off.tail);
+    r->cq_mask=(unsigned *)(cq+p.cq_off.ring_mask);
+    r->cqes=(struct io_uring_cqe *)(cq+p.cq_off.cqes);
+
+    return true;
 }
 
-void quit(void)
+void free_uring(Uring *r)
 {
-    if(has_flashcard(flashcards))
+    if(r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->sqes_size);
+    if(r->cq_ring!=MAP_FAILED && r->cq_ring!=r->sq_ring)
+        munmap(r->cq_ring, r->cq_ring_size);
+    if(r->sq_ring != MAP_FAILED)
+        munmap(r->sq_ring, r->sq_ring_size);
+    close(r->fd);
+}
+#endif
+
+/* 一開始就讓AIO_DEPTH個讀請求預讀文件開頭的各塊，每讀完一塊就讓其請求
+ * 去預讀後面的一塊，使解析與讀取重疊 */
+void open_reader(Reader *r, int fd)
+{
+    open_aio(&r->aio, fd);
+    for(int i=0; i<AIO_DEPTH; i++)
     {
-        sort_flashcard(flashcards);
-        update_data_file(flashcards, data_file);
+        r->aio.slots[i].offset=(off_t)i*AIO_BLOCK;
+        r->aio.slots[i].len=AIO_BLOCK;
+        submit_aio(&r->aio, i);
     }
-    if(flashcards)
-        free_flashcards(flashcards);
-    exit(EXIT_SUCCESS);
+    r->next=(off_t)AIO_DEPTH*AIO_BLOCK;
+    r->cur=0, r->pos=0, r->offset=0;
+    r->eof=false;
 }
 
-void update_data_file(const Flashcard *list, const char *data_file)
+/* 與fgets相同：讀入一行，至多size-1個字節，文件已讀完時返回NULL */
+char *read_line(char *line, int size, Reader *r)
 {
-    FILE *fp=Fopen(data_file, "w");
+    size_t n=0;
 
-    fputs(list->comment, fp);
-    for(Flashcard *p=list->next; p; p=p->next)
+    while(n+1<(size_t)size && !r->eof)
     {
-        fputs("\n", fp);
-        fputs(">>\n", fp);
-        fputs(p->comment, fp);
-        fputs("Q:\n", fp);
-        fputs(p->question, fp);
-        fputs("A:\n", fp);
-        fputs(p->answer, fp);
-        fputs("S:\n", fp);
-        fprintf(fp, "    %d %d %g %lu %lu\n", p->nquiz, p->n_contin_right,
-            p->right_rate, p->prev_time, p->next_time);
-        fputs("<<\n", fp);
+        Aio_slot *s=r->aio.slots+r->cur;
+        const char *p=NULL, *nl=NULL;
+        size_t len;
+
+        wait_aio(&r->aio, r->cur);
+        if(r->aio.failed)
+            die(_("讀取文件失敗\n"));
+        if(r->pos == s->len) // 讀完了這一塊
+        {
+            if(s->len < AIO_BLOCK)
+            {
+                r->eof=true;
+                break;
+            }
+            s->offset=r->next, s->len=AIO_BLOCK;
+            r->next+=AIO_BLOCK;
+            submit_aio(&r->aio, r->cur);
+            r->cur=(r->cur+1)%AIO_DEPTH, r->pos=0;
+            continue;
+        }
+
+        p=s->buf+r->pos;
+        len=s->len-r->pos;
+        if(len > size-1-n)
+            len=size-1-n;
+        if((nl=memchr(p, '\n', len)))
+            len=nl-p+1;
+        memcpy(line+n, p, len);
+        n+=len, r->pos+=len, r->offset+=len;
+        if(nl)
+            break;
     }
+    if(n == 0)
+        return NULL;
+    line[n]='\0';
 
-    fclose(fp);
+    return line;
 }
 
 void show_template(void)
@@ -541,15 +5053,30 @@ void show_template(void)
     puts(_("# 只能由後向前依次省略，其中後兩者不應手動錄入。程序更新本表時"));
     puts(_("# 會有選擇地保留注釋，包括：頭部注釋、抽認卡記錄內部注釋。"));
     puts(_("# 問題或答案的內部，以“:”開頭的行，將視爲命令行。"));
+    puts(_("# 統計信息的最後一項是平均答題用時（單位：秒），由程序自動記錄。"));
+    puts(_("# 可選的卡組開始標記(D:)之後是以/分隔的卡組路徑，用於把抽認卡"));
+    puts(_("# 歸入嵌套的卡組。"));
+    puts(_("# 可選的反向標記(R:)表示還要以答案爲問題進行反向復習，其後是反向"));
+    puts(_("# 復習的統計信息，格式同上。"));
+    puts(_("# 問題中的{{c序號::文字}}或{{c序號::文字::提示}}是填空標記，每個填空"));
+    puts(_("# 序號各成一個抽認卡，其統計信息逐行列出，各行以c序號開頭。"));
+    puts(_("# 可選的校驗標記(C:)之後是記錄的CRC32C校驗和，由程序計算，手動錄入"));
+    puts(_("# 時留空即可。"));
     puts("");
     puts(">>");
     puts("[# 注釋]");
+    puts("[D:]");
+    puts(_("    [卡組路徑，如：外語/英語/詞匯]"));
     puts("Q:");
     puts(_("    具體問題"));
     puts("A:");
     puts(_("    具體答案"));
     puts("S:");
-    puts(_("    [復習次數] [連續答對次數] [正確率] [上次復習時間] [下次復習時間]"));
+    puts(_("    [復習次數] [連續答對次數] [正確率] [上次復習時間] [下次復習時間] [平均答題用時]"));
+    puts("[R:]");
+    puts(_("    [反向復習的統計信息]"));
+    puts("[C:]");
+    puts(_("    [校驗和]"));
     puts("<<");
     puts("");
     puts(_("[其他抽認卡記錄]"));
@@ -564,7 +5091,543 @@ void help(void)
     puts(_("    quit      退出本程序。"));
     puts(_("    temp      顯示數據文件模板。"));
     puts(_("    clear     清屏。"));
+    puts(_("    deck      顯示各卡組的統計信息。"));
+}
+
+/* 監視模式：以timerfd定時到各數據文件中最早的下次復習時間，以inotify監視
+ * 數據文件的變化。空閑時阻塞於poll，不佔用處理器 */
+void watch(const char *program, int n, char **filenames)
+{
+#if HAVE_TIMERFD && HAVE_INOTIFY
+    const char *hook=NULL;
+    int tfd=timerfd_create(CLOCK_REALTIME, 0), ifd=inotify_init(), nw=0;
+    Watch *w=NULL;
+    time_t after=0, due=0;
+
+    if(tfd==-1 || ifd==-1)
+        die(_("不能創建定時器或文件監視器\n"));
+    signal(SIGCHLD, SIG_IGN); // 自動回收執行提醒命令的子進程
+    for(int i=0; i<n; i++)
+    {
+        if(strcmp(filenames[i], "--hook")==0 && i+1<n)
+            hook=filenames[++i];
+        else
+        {
+            int k=1;
+            char **names=expand_manifests(&k, filenames+i); // 分卷時監視各卷
+            w=Realloc(w, (nw+k)*sizeof(Watch));
+            for(int j=0; j<k; j++)
+            {
+                w[nw].filename=names[j], w[nw].mtime=0;
+                scan_watch(&w[nw], ifd, after);
+                if(w[nw++].wd == -1)
+                    die(_("打開文件失敗：%s\n"), names[j]);
+            }
+            Free(names);
+        }
+    }
+    if(nw == 0)
+        usage(program);
+    notify_due(w, nw, hook);
+    after=time(NULL);
+    for(int i=0; i<nw; i++)
+        w[i].mtime=0, scan_watch(&w[i], ifd, after);
+
+    while(1)
+    {
+        struct pollfd fds[2]={{tfd, POLLIN, 0}, {ifd, POLLIN, 0}};
+        struct itimerspec t={{0, 0}, {0, 0}};
+        char buf[4096];
+
+        due=0;
+        for(int i=0; i<nw; i++)
+            if(w[i].due_time && (due==0 || w[i].due_time<due))
+                due=w[i].due_time;
+        t.it_value.tv_sec=due;
+        if(due && due<=time(NULL)) // 已經到期，立即觸發
+            t.it_value.tv_nsec=1;
+        timerfd_settime(tfd, TFD_TIMER_ABSTIME, &t, NULL);
+
+        if(poll(fds, 2, -1) == -1)
+            continue;
+        if(fds[0].revents & POLLIN)
+        {
+            uint64_t expirations;
+            if(read(tfd, &expirations, sizeof(expirations)) > 0)
+            {
+                notify_due(w, nw, hook);
+                after=time(NULL);
+                for(int i=0; i<nw; i++)
+                    w[i].mtime=0, scan_watch(&w[i], ifd, after);
+            }
+        }
+        if(fds[1].revents & POLLIN)
+        {
+            if(read(ifd, buf, sizeof(buf)) > 0)
+                for(int i=0; i<nw; i++)
+                    scan_watch(&w[i], ifd, after);
+        }
+    }
+#else
+    (void)program, (void)n, (void)filenames;
+    die(_("本程序不支持監視模式。\n"));
+#endif
+}
+
+/* 返回數據文件中晚於after的最早的下次復習時間，沒有時返回0；並由ndue返回
+ * 已到期的未形成長時記憶的抽認卡個數 */
+time_t get_due_time(const char *filename, time_t after, time_t now, int *ndue)
+{
+    char line[LINE_MAX];
+    bool in_info=false;
+    time_t due=0;
+    FILE *fp=fopen(filename, "r");
+
+    *ndue=0;
+    if(fp == NULL)
+        return 0;
+    while(fgets(line, LINE_MAX, fp))
+    {
+        int nquiz=0, n_contin_right=0;
+        double rate;
+        long long prev_time, next_time;
+
+        if((line[0]=='S' || line[0]=='R') && line[1]==':')
+            in_info=true;
+        else if(isupper((unsigned char)line[0]) && line[1]==':')
+            in_info=false;
+        else if(line[0]=='<' && line[1]=='<')
+            in_info=false;
+        else if(in_info && !is_blank(line))
+        {
+            const char *s=line+strspn(line, " \t");
+            if(s[0]=='c' && isdigit((unsigned char)s[1])) // 跳過填空抽認卡的c序號
+                for(s++; isdigit((unsigned char)*s); s++)
+                    ;
+            int n=sscanf(s, "%d %d %lf %lld %lld", &nquiz, &n_contin_right,
+                &rate, &prev_time, &next_time);
+            if(n_contin_right >= N_LONG_TERM_MEMORY)
+                continue;
+            if(n<5 || (time_t)next_time<=now)
+                (*ndue)++;
+            else if((time_t)next_time>after && (due==0 || (time_t)next_time<due))
+                due=next_time;
+        }
+    }
+    fclose(fp);
+
+    return due;
+}
+
+#if HAVE_TIMERFD && HAVE_INOTIFY
+/* 數據文件的修改時間有變化時，重新監視它並讀取其中的下次復習時間。
+ * 編輯器常以新文件替換原文件，故每次都要重新加入監視 */
+void scan_watch(Watch *w, int ifd, time_t after)
+{
+    struct stat st;
+    int ndue;
+    bool found;
+
+    w->wd=inotify_add_watch(ifd, w->filename,
+        IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF | IN_ATTRIB);
+    found = stat(w->filename, &st)==0;
+    if(found && st.st_mtime==w->mtime)
+        return;
+    w->mtime = found && w->wd!=-1 ? st.st_mtime : 0;
+    w->due_time=get_due_time(w->filename, after, time(NULL), &ndue);
+}
+
+void notify_due(const Watch *w, int n, const char *hook)
+{
+    char num[32];
+    int ndue;
+
+    for(int i=0; i<n; i++)
+    {
+        get_due_time(w[i].filename, 0, time(NULL), &ndue);
+        if(ndue == 0)
+            continue;
+        if(hook)
+        {
+            sprintf(num, "%d", ndue);
+            setenv("GFLASHCARD_FILE", w[i].filename, 1);
+            setenv("GFLASHCARD_DUE", num, 1);
+            exec_sys_cmd(hook);
+        }
+        else
+        {
+            putchar('\a'); // 響鈴提醒
+            printf(_("%s：有%d個抽認卡需要復習。\n"), w[i].filename, ndue);
+            fflush(stdout);
+        }
+    }
+}
+#endif
+
+/* 並行檢查各數據文件，分卷清單則檢查其各卷，按輸入次序輸出檢查報告。有錯誤時
+ * 返回EXIT_FAILURE */
+int check_files(int n, char **filenames, void (*check)(const char *filename,
+    const char *data, size_t len, FILE *out, int *nerror))
+{
+    Check_pool pool;
+    int nerror=0;
+
+    filenames=expand_manifests(&n, filenames);
+    if(n == 0)
+        return EXIT_SUCCESS;
+
+    pool.checks=Malloc(n*sizeof(Check)), pool.n=n, pool.next=0;
+    pool.check=check;
+    for(int i=0; i<n; i++)
+    {
+        pool.checks[i].filename=filenames[i], pool.checks[i].report=NULL;
+        pool.checks[i].size=0, pool.checks[i].nerror=0, pool.checks[i].done=false;
+    }
+
+#if HAVE_PTHREAD
+    long nthread=sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t *threads=NULL;
+
+    nthread = nthread<1 ? 1 : (nthread>n ? n : nthread);
+    threads=Malloc(nthread*sizeof(pthread_t));
+    pthread_mutex_init(&pool.mutex, NULL);
+    pthread_cond_init(&pool.cond, NULL);
+    for(long i=0; i<nthread; i++)
+        if(pthread_create(&threads[i], NULL, check_worker, &pool))
+            die(_("不能創建線程\n"));
+    for(int i=0; i<n; i++) // 邊等待邊輸出，不必等到全部檢查完畢
+    {
+        pthread_mutex_lock(&pool.mutex);
+        while(!pool.checks[i].done)
+            pthread_cond_wait(&pool.cond, &pool.mutex);
+        pthread_mutex_unlock(&pool.mutex);
+        fwrite(pool.checks[i].report, 1, pool.checks[i].size, stdout);
+        nerror+=pool.checks[i].nerror;
+        Free(pool.checks[i].report);
+    }
+    for(long i=0; i<nthread; i++)
+        pthread_join(threads[i], NULL);
+    pthread_cond_destroy(&pool.cond);
+    pthread_mutex_destroy(&pool.mutex);
+    Free(threads);
+#else
+    check_worker(&pool);
+    for(int i=0; i<n; i++)
+    {
+        fwrite(pool.checks[i].report, 1, pool.checks[i].size, stdout);
+        nerror+=pool.checks[i].nerror;
+        Free(pool.checks[i].report);
+    }
+#endif
+    Free(pool.checks);
+    for(int i=0; i<n; i++)
+        Free(filenames[i]);
+    Free(filenames);
+
+    return nerror ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+void *check_worker(void *arg)
+{
+    Check_pool *pool=arg;
+
+    while(1)
+    {
+        Check *check=NULL;
+#if HAVE_PTHREAD
+        pthread_mutex_lock(&pool->mutex);
+        if(pool->next < pool->n)
+            check=&pool->checks[pool->next++];
+        pthread_mutex_unlock(&pool->mutex);
+#else
+        if(pool->next < pool->n)
+            check=&pool->checks[pool->next++];
+#endif
+        if(check == NULL)
+            return NULL;
+
+        check_file(check, pool);
+#if HAVE_PTHREAD
+        pthread_mutex_lock(&pool->mutex);
+        check->done=true;
+        pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->mutex);
+#else
+        check->done=true;
+#endif
+    }
+}
+
+/* 把數據文件整個映射到內存中檢查，不支持mmap時則整個讀入 */
+void check_file(Check *check, const Check_pool *pool)
+{
+    FILE *out=open_memstream(&check->report, &check->size);
+    char *data=NULL;
+    size_t len=0;
+
+    if(out == NULL)
+        die(_("錯誤：內存不足！"));
+#if HAVE_MMAP
+    struct stat st;
+    int fd=open(check->filename, O_RDONLY);
+    if(fd!=-1 && fstat(fd, &st)==0)
+    {
+        len=st.st_size;
+        data = len ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+        if(data == MAP_FAILED)
+            data=NULL, len=0;
+        else if(data)
+            posix_madvise(data, len, POSIX_MADV_SEQUENTIAL);
+        pool->check(check->filename, data ? data : "", len, out, &check->nerror);
+        if(data)
+            munmap(data, len);
+    }
+    else
+        fprintf(out, _("%s: 打開文件失敗\n"), check->filename), check->nerror++;
+    if(fd != -1)
+        close(fd);
+#else
+    FILE *fp=fopen(check->filename, "rb");
+    if(fp)
+    {
+        for(size_t n=0; (data=realloc(data, len+BUFSIZ)) && (n=fread(data+len, 1, BUFSIZ, fp)); )
+            len+=n;
+        if(data == NULL)
+            die(_("錯誤：內存不足！"));
+        pool->check(check->filename, data, len, out, &check->nerror);
+        Free(data);
+        fclose(fp);
+    }
+    else
+        fprintf(out, _("%s: 打開文件失敗\n"), check->filename), check->nerror++;
+#endif
+    fclose(out);
+}
+
+/* 逐行檢查數據文件的內容，發現的錯誤寫入out */
+void check_data(const char *filename, const char *data, size_t len, FILE *out, int *nerror)
+{
+    enum { DECK, QUESTION, ANSWER, STATISTICS, REVERSE, CHECKSUM, IGNORE } stage=IGNORE;
+    char line[LINE_MAX];
+    int lineno=0, start=0; // start爲當前記錄的起始行號，0表示不在記錄內
+    bool has_question=false;
+
+#define report(...) (fprintf(out, "%s:%d: ", filename, lineno), \
+    fprintf(out, __VA_ARGS__), (*nerror)++)
+
+    for(const char *p=data, *end=data+len, *eol=NULL; p<end; p=eol)
+    {
+        size_t n;
+        eol=memchr(p, '\n', end-p);
+        eol = eol ? eol+1 : end;
+        n=eol-p, lineno++;
+        if(!is_valid_utf8(p, n))
+            report(_("不是有效的UTF-8文字\n"));
+        if(n > LINE_MAX-1)
+            report(_("行過長（超過%d字節）\n"), LINE_MAX-1), n=LINE_MAX-1;
+        memcpy(line, p, n), line[n]='\0';
+        strip_cr(line);
+
+        if(line[0]=='>' && line[1]=='>')
+        {
+            if(start)
+                report(_("第%d行開始的記錄缺少記錄結束標記(<<)\n"), start);
+            start=lineno, stage=IGNORE, has_question=false;
+        }
+        else if(line[0]=='#' || is_blank(line))
+            continue;
+        else if(start == 0)
+        {
+            if(line[0]=='Q' && line[1]==':')
+                report(_("問題開始標記(Q:)不在記錄之內\n"));
+            else if(line[0]=='<' || (isupper((unsigned char)line[0]) && line[1]==':'))
+                report(_("缺少記錄開始標記(>>)\n"));
+        }
+        else if(line[0]=='<' && line[1]=='<')
+        {
+            if(!has_question)
+                report(_("記錄缺少問題開始標記(Q:)\n"));
+            start=0;
+        }
+        else if(line[0]=='D' && line[1]==':')
+            stage=DECK;
+        else if(line[0]=='Q' && line[1]==':')
+            stage=QUESTION, has_question=true;
+        else if(line[0]=='A' && line[1]==':')
+            stage=ANSWER;
+        else if(line[0]=='S' && line[1]==':')
+            stage=STATISTICS;
+        else if(line[0]=='R' && line[1]==':')
+            stage=REVERSE;
+        else if(line[0]=='C' && line[1]==':')
+            stage=CHECKSUM;
+        else if((stage==STATISTICS || stage==REVERSE) && !is_valid_info(line))
+            report(_("統計信息格式有誤\n"));
+        else if(stage == CHECKSUM)
+        {
+            const char *p=line+strspn(line, " \t");
+            size_t n=strspn(p, "0123456789abcdefABCDEF");
+            if(n>8 || !is_blank(p+n))
+                report(_("校驗和格式有誤\n"));
+        }
+    }
+    if(start)
+        report(_("第%d行開始的記錄缺少記錄結束標記(<<)\n"), start);
+
+#undef report
+}
+
+/* 統計信息依次爲兩個整數、一個實數、兩個非負整數和一個實數，均可省略後若干項；
+ * 填空抽認卡的統計信息之前還有c序號 */
+bool is_valid_info(const char *line)
+{
+    const char *p=line+strspn(line, " \t");
+    char *end=NULL;
+
+    if(p[0]=='c' && isdigit((unsigned char)p[1]))
+    {
+        strtol(p+1, &end, 10);
+        if(*end && !isspace((unsigned char)*end))
+            return false;
+        p=end;
+    }
+
+    for(int i=0; i<6; i++, p=end)
+    {
+        while(isspace((unsigned char)*p))
+            p++;
+        if(*p == '\0')
+            return true;
+        if(i==2 || i==5)
+            strtod(p, &end);
+        else
+            strtoll(p, &end, 10);
+        if(end==p || (*end && !isspace((unsigned char)*end)))
+            return false;
+    }
+
+    return is_blank(p);
+}
+
+/* 驗證數據文件中各記錄的校驗和 */
+void scrub_data(const char *filename, const char *data, size_t len, FILE *out, int *nerror)
+{
+    int lineno=0, start=0, nok=0, nbad=0, nnone=0;
+    const char *record=NULL;
+
+    for(const char *p=data, *end=data+len, *eol=NULL; p<end; p=eol)
+    {
+        eol=memchr(p, '\n', end-p);
+        eol = eol ? eol+1 : end;
+        lineno++;
+        if(eol-p>=2 && p[0]=='>' && p[1]=='>')
+            record=eol, start=lineno;
+        else if(eol-p>=2 && p[0]=='<' && p[1]=='<' && record)
+        {
+            switch(verify_record(record, p-record))
+            {
+                case 1: nok++; break;
+                case 0: nbad++, fprintf(out, _("%s:%d: 記錄校驗失敗\n"), filename, start); break;
+                default: nnone++;
+            }
+            record=NULL;
+        }
+    }
+    fprintf(out, _("%s: %d個記錄通過校驗，%d個記錄校驗失敗，%d個記錄沒有校驗和。\n"),
+        filename, nok, nbad, nnone);
+    *nerror+=nbad;
+}
+
+/* 校驗記錄開始標記和記錄結束標記之間的內容。返回1表示通過，0表示不通過，
+ * -1表示沒有校驗和或校驗和留空 */
+int verify_record(const char *record, size_t len)
+{
+    const char *end=record+len;
+    uint32_t crc=0;
+
+    for(const char *p=record, *eol=NULL; p<end; p=eol)
+    {
+        eol=memchr(p, '\n', end-p);
+        eol = eol ? eol+1 : end;
+        if(eol-p>=2 && p[0]=='C' && p[1]==':')
+        {
+            uint32_t sum=0;
+            int n=0;
+            const char *q=eol;
+            while(q<end && (*q==' ' || *q=='\t'))
+                q++;
+            for(; q<end && n<8 && isxdigit((unsigned char)*q); q++, n++)
+                sum = sum<<4 | (isdigit((unsigned char)*q) ? *q-'0' : (tolower((unsigned char)*q)-'a'+10));
+            return n ? crc==sum : -1;
+        }
+        if(eol-p>=2 && eol[-1]=='\n' && eol[-2]=='\r') // 按換成\n之後的內容計算
+            crc=crc32c(crc32c(crc, p, eol-p-2), "\n", 1);
+        else
+            crc=crc32c(crc, p, eol-p);
+    }
+    return -1;
+}
+
+void init_crc32c(void)
+{
+    for(uint32_t i=0; i<256; i++)
+    {
+        uint32_t c=i;
+        for(int k=0; k<8; k++)
+            c = c&1 ? (c>>1)^0x82F63B78 : c>>1;
+        crc32c_table[0][i]=c;
+    }
+    for(int t=1; t<8; t++)
+        for(int i=0; i<256; i++)
+            crc32c_table[t][i]=(crc32c_table[t-1][i]>>8)
+                ^ crc32c_table[0][crc32c_table[t-1][i]&0xff];
+#if HAVE_SSE42_CRC32
+    if(__builtin_cpu_supports("sse4.2"))
+        crc32c_impl=crc32c_hw;
+#endif
+}
+
+/* 計算CRC32C（Castagnoli多項式）。crc爲先前部分的結果，從頭計算時爲0。
+ * 處理器支持SSE4.2時用crc32指令，否則查表 */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len)
+{
+    return crc32c_impl(crc, data, len);
+}
+
+/* 每次查8個表處理8個字節 */
+uint32_t crc32c_sw(uint32_t crc, const void *data, size_t len)
+{
+    const unsigned char *p=data;
+    uint32_t (*t)[256]=crc32c_table;
+
+    crc=~crc;
+    for(; len>=8; len-=8, p+=8)
+    {
+        uint32_t lo=crc^(p[0] | p[1]<<8 | p[2]<<16 | (uint32_t)p[3]<<24);
+        crc=t[7][lo&0xff] ^ t[6][(lo>>8)&0xff] ^ t[5][(lo>>16)&0xff] ^ t[4][lo>>24]
+            ^ t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+    }
+    for(; len; len--)
+        crc=(crc>>8)^t[0][(crc^*p++)&0xff];
+
+    return ~crc;
+}
+
+#if HAVE_SSE42_CRC32
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hw(uint32_t crc, const void *data, size_t len)
+{
+    const unsigned char *p=data;
+    uint64_t c=~crc, w;
+
+    for(; len>=8; len-=8, p+=8)
+        memcpy(&w, p, 8), c=_mm_crc32_u64(c, w);
+    for(; len; len--)
+        c=_mm_crc32_u8((uint32_t)c, *p++);
+
+    return ~(uint32_t)c;
 }
+#endif
 
 void *Malloc(size_t size)
 {
@@ -577,7 +5640,8 @@ void *Malloc(size_t size)
 void *Realloc(void *ptr, size_t size)
 {
     void *p=realloc(ptr, size);
-    if(ptr == p)
+    if(p==NULL && size)
         die(_("錯誤：內存不足！"));
     return p;
 }
+
@@ -0,0 +1,68 @@
+# *************************************************************************
+#     po2c.awk：把po目錄下的各.po文件轉換成內嵌於程序中的譯文表。
+#     版權 (C) 2024 gsm <406643764@qq.com>
+#     本程序為自由軟件：你可以依據自由軟件基金會所發布的第三版或更高版本的
+# GNU通用公共許可證重新發布、修改本程序。
+#     雖然基于使用目的而發布本程序，但不負任何擔保責任，亦不包含適銷性或特
+# 定目標之適用性的暗示性擔保。詳見GNU通用公共許可證。
+#     你應該已經收到一份附隨此程序的GNU通用公共許可證副本。否則，請參閱
+# <http://www.gnu.org/licenses/>。
+# *************************************************************************
+
+# 用法：awk -f po2c.awk ../po/*/LC_MESSAGES/*.po > messages.h
+# 語言名取自路徑中LC_MESSAGES的上一級目錄名。.po中的字符串已是C語言的轉義
+# 形式，原樣寫出；表頭、未翻譯和模糊翻譯的條目不寫出
+
+BEGIN {
+    print "/* 內嵌的譯文表，由po2c.awk從po目錄下的各.po文件生成，請勿手工修改 */"
+    n = 0
+}
+
+FNR == 1 {
+    flush()
+    marked = 0
+    if (n)
+        print "};"
+    lang[n] = FILENAME
+    sub(/\/LC_MESSAGES\/[^\/]*$/, "", lang[n])
+    sub(/.*\//, "", lang[n])
+    printf "static Message messages_%d[]={\n", n++
+}
+
+# 標記在msgid之前，先記下，待前一條目寫出後再歸入本條目
+/^#,.*fuzzy/ { marked = 1 }
+/^msgid / { flush(); fuzzy = marked; marked = 0; id = unquote($0); part = "id"; next }
+/^msgstr / { str = unquote($0); part = "str"; next }
+/^"/ {
+    if (part == "id")
+        id = id unquote($0)
+    else if (part == "str")
+        str = str unquote($0)
+    next
+}
+/^[ \t]*$/ { flush() }
+
+END {
+    flush()
+    if (n)
+        print "};"
+    print "static Catalog catalogs[]={"
+    for (i = 0; i < n; i++)
+        printf "    {\"%s\", messages_%d, sizeof(messages_%d)/sizeof(Message)},\n", lang[i], i, i
+    print "};"
+}
+
+function unquote(s)
+{
+    sub(/^[^"]*"/, "", s)
+    sub(/"[ \t]*$/, "", s)
+    return s
+}
+
+function flush()
+{
+    if (id != "" && str != "" && !fuzzy)
+        printf "    {\"%s\", \"%s\"},\n", id, str
+    id = str = part = ""
+    fuzzy = 0
+}